@@ -0,0 +1,1296 @@
+/* bench: runs fumio~, ota~, ring64~ and zdsv~ outside Pd and reports what
+   their perform routines cost. The m_pd.h next to this file stands in for
+   Pd's and this file implements it: class_new and class_addmethod fill a
+   table, the routines each dsp method adds are collected in a chain, and
+   bench calls the chain block by block on generated input signals.
+
+   Build from the top of the repository (add -DSINGLE_PRECISION, -mavx2
+   and so on to compare builds of the externals):
+
+   cc -O2 -IBench -o bench Bench/bench.c "RK4 Filters/Src/fumio~.c" \
+       "RK4 Filters/Src/ota~.c" "ZDF Filters/Src/ring64~.c" \
+       "ZDF Filters/Src/zdsv~.c" -lm -lpthread
+
+   usage: bench [options], where lists are comma separated
+   -x fumio,ota,ring64,zdsv   externals to run (default all)
+   -i noise,impulse,sweep     signal at the main inlet (default all)
+   -b 64,1024                 block sizes (default 64,1024)
+   -r 44100,96000             sample rates (default 44100,96000)
+   -o 1,2,4                   oversample of fumio~ and ota~ (default 1,2,4)
+   -B 16,64,256               bands of ring64~ (default 16,64,256)
+   -c n                       channels of a multichannel signal (default 1)
+   -k n                       objects of each external (default 1)
+   -s seconds                 of signal in each run (default 1)
+   -R n                       runs of each case, the fastest counts (default 3)
+   -H n                       parameters hold still for n blocks at a time,
+                              as floats or control rate messages would
+                              (default 0, a new value every sample)
+   -M 1,2,3                   modes of fumio~ (default 1,2,3)
+   -C                         count the L1 data cache read misses and last
+                              level cache misses per sample as well (Linux
+                              perf events, n/a where they can't be read)
+   -m "selector args"         message to every new object, can repeat
+   -a "selector args"         message to every object after the last run
+                              of a case, such as print or stats
+   -w dir                     write reference renders and times to dir
+   -g dir                     check against the references in dir
+   -e dB                      tolerance of the check, below the reference
+                              peak (default set for each external)
+   -p percent                 slower than the reference time that fails the
+                              check (default 25, 0 to not check times)
+   -v                         run the variants of each case as well, see
+                              benchvariants
+
+   The cutoff inlet sweeps exponentially and the resonance inlet linearly
+   over each run, both within the range of the external, in steps of n
+   blocks with -H. Every case prints
+   the time per sample of one channel of one object, the samples per
+   second that makes, and the output peak as a check that the filter did
+   run. With -C it also prints the cache misses per sample of the fastest
+   run, which is what a memory layout change should show: run many objects
+   (-k 256) or many bands so that their states no longer fit the caches.
+
+   Before changing a kernel, write references from the build as it is
+   ("bench -w refs" into an existing directory) and after the change check
+   the new build with the same options ("bench -g refs"). The check
+   compares each render with its reference and fails where they differ
+   by more than the tolerance, or where the case has become slower by
+   more than -p. The exit status is 1 if any case failed. The references
+   are raw 32 bit floats, one file per case, and times.txt.
+
+   Bench/refs holds a short render of each input for every external,
+   every mode of fumio~ and a range of ring64~ band counts, made from the
+   sources as they were before the optimisations (the band counts over
+   64, which those could not run, from the sources as they are). With -v
+   it also holds the renders of the variants that take another code
+   path (quality, solver, antialias, sleep, engine, coeffrate), made from
+   the sources as they are; the variants that should not change the
+   output (simd, threads, isa, batch, multichannel) are checked against
+   the plain case in the same run instead:
+
+   bench -s 0.05 -R 1 -b 64 -r 44100 -o 2 -B 1,16,64,256,1024 -M 1,2,3 \
+       -v -g Bench/refs
+
+   checks a build against them. Builds with other compilers, flags or
+   FMA stay well within the tolerances; the float build
+   (-DSINGLE_PRECISION) needs a looser -e.
+
+   The time check is manual: the times depend on the machine, so no
+   times.txt is kept in Bench/refs. Write references with -w on the
+   machine before a change and check with -g on the same machine after
+   it. */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+#ifdef __linux__
+#define _DEFAULT_SOURCE // syscall
+#define HAVE_PERF
+#endif
+#include "m_pd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#ifdef HAVE_PERF
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* ------------------------- the Pd API ------------------------------ */
+
+#define MAXARGS 5
+#define MAXMETHODS 64
+
+typedef struct _methodentry
+{
+    t_symbol *me_sel;
+    t_method me_fn;
+    t_atomtype me_args[MAXARGS + 1]; // A_NULL terminated
+} t_methodentry;
+
+struct _class
+{
+    t_symbol *c_name;
+    t_newmethod c_new;
+    t_method c_free;
+    size_t c_size;
+    t_atomtype c_arg; // of the new method: A_NULL or A_DEFFLOAT
+    t_methodentry c_methods[MAXMETHODS];
+    int c_nmethods;
+    struct _class *c_next;
+};
+
+struct _outlet { int o_dummy; };
+struct _inlet { int i_dummy; };
+
+t_symbol s_signal = {"signal", 0, 0}, s_float = {"float", 0, 0},
+    s_symbol = {"symbol", 0, 0}, s_bang = {"bang", 0, 0},
+    s_list = {"list", 0, 0}, s_ = {"", 0, 0};
+t_class *garray_class;
+
+static t_symbol *symlist;
+static t_class *classlist;
+static t_outlet dummyoutlet;
+static t_inlet dummyinlet;
+
+t_symbol *gensym(const char *s)
+{
+    t_symbol *sym;
+    char *name;
+    for (sym = symlist; sym; sym = sym->s_next)
+        if (!strcmp(sym->s_name, s))
+            return (sym);
+    sym = (t_symbol *)getbytes(sizeof(*sym));
+    name = (char *)getbytes(strlen(s) + 1);
+    strcpy(name, s);
+    sym->s_name = name;
+    sym->s_next = symlist;
+    return (symlist = sym);
+}
+
+void *getbytes(size_t nbytes)
+{
+    void *p = calloc(1, nbytes ? nbytes : 1);
+    if (!p)
+        fprintf(stderr, "bench: out of memory\n");
+    return (p);
+}
+
+void *resizebytes(void *old, size_t oldsize, size_t newsize)
+{
+    char *p = (char *)realloc(old, newsize ? newsize : 1);
+    if (p && newsize > oldsize)
+        memset(p + oldsize, 0, newsize - oldsize);
+    return (p);
+}
+
+void freebytes(void *x, size_t nbytes)
+{
+    free(x);
+}
+
+void post(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+void error(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fputs("error: ", stdout);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+void pd_error(const void *object, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fputs("error: ", stdout);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+    size_t size, int flags, t_atomtype arg1, ...)
+{
+    t_class *c = (t_class *)getbytes(sizeof(*c));
+    c->c_name = name;
+    c->c_new = newmethod;
+    c->c_free = freemethod;
+    c->c_size = size;
+    c->c_arg = arg1;
+    c->c_next = classlist;
+    return (classlist = c);
+}
+
+void class_addmethod(t_class *c, t_method fn, t_symbol *sel,
+    t_atomtype arg1, ...)
+{
+    t_methodentry *m = &c->c_methods[c->c_nmethods];
+    t_atomtype a = arg1;
+    int i = 0;
+    va_list ap;
+    if (c->c_nmethods == MAXMETHODS)
+    {
+        fprintf(stderr, "bench: %s: too many methods\n", c->c_name->s_name);
+        return;
+    }
+    m->me_sel = sel;
+    m->me_fn = fn;
+    va_start(ap, arg1);
+    while (a != A_NULL && i < MAXARGS)
+    {
+        m->me_args[i++] = a;
+        a = (t_atomtype)va_arg(ap, int);
+    }
+    va_end(ap);
+    m->me_args[i] = A_NULL;
+    c->c_nmethods++;
+}
+
+void class_domainsignalin(t_class *c, int onset)
+{
+}
+
+t_pd *pd_new(t_class *cls)
+{
+    t_pd *x = (t_pd *)getbytes(cls->c_size);
+    if (x)
+        *x = cls;
+    return (x);
+}
+
+void pd_free(t_pd *x)
+{
+    if ((*x)->c_free)
+        ((void (*)(t_pd *))(*x)->c_free)(x);
+    freebytes(x, (*x)->c_size);
+}
+
+/* there are no arrays outside Pd */
+t_pd *pd_findbyclass(t_symbol *s, const t_class *c)
+{
+    return (0);
+}
+
+int garray_getfloatwords(t_garray *x, int *size, t_word **vec)
+{
+    return (0);
+}
+
+void garray_usedindsp(t_garray *x)
+{
+}
+
+t_outlet *outlet_new(t_object *owner, t_symbol *s)
+{
+    return (&dummyoutlet);
+}
+
+t_inlet *inlet_new(t_object *owner, t_pd *dest, t_symbol *s1, t_symbol *s2)
+{
+    return (&dummyinlet);
+}
+
+t_float atom_getfloat(const t_atom *a)
+{
+    return (a->a_type == A_FLOAT ? a->a_w.w_float : 0);
+}
+
+t_float atom_getfloatarg(int which, int argc, const t_atom *argv)
+{
+    return (which < argc ? atom_getfloat(argv + which) : 0);
+}
+
+t_symbol *atom_getsymbol(const t_atom *a)
+{
+    return (a->a_type == A_SYMBOL ? a->a_w.w_symbol : &s_);
+}
+
+t_symbol *atom_getsymbolarg(int which, int argc, const t_atom *argv)
+{
+    return (which < argc ? atom_getsymbol(argv + which) : &s_);
+}
+
+/* ------------------------ the dsp chain ---------------------------- */
+
+#define MAXDSPARGS 10
+#define MAXSIGNALS 8192 // outlet signals of all objects
+
+typedef struct _dspcall
+{
+    t_int d_w[MAXDSPARGS + 1]; // w[0] is the routine, as in Pd
+} t_dspcall;
+
+static t_dspcall *dspchain;
+static int dspn, dspsize;
+static t_signal *signals[MAXSIGNALS]; // made by bench_newsignal
+static int nsignals;
+static t_signal *outputs[MAXSIGNALS]; // the outlets of the objects, in order
+static int noutputs;
+static int benchn; // block size of the chain being built
+static t_float benchsr;
+
+void dsp_add(t_perfroutine f, int n, ...)
+{
+    va_list ap;
+    int i;
+    if (n > MAXDSPARGS)
+    {
+        fprintf(stderr, "bench: dsp_add: %d arguments\n", n);
+        return;
+    }
+    if (dspn == dspsize)
+    {
+        int newsize = (dspsize ? 2 * dspsize : 16);
+        dspchain = (t_dspcall *)resizebytes(dspchain,
+            dspsize * sizeof(t_dspcall), newsize * sizeof(t_dspcall));
+        dspsize = newsize;
+    }
+    dspchain[dspn].d_w[0] = (t_int)f;
+    va_start(ap, n);
+    for (i = 1; i <= n; i++)
+        dspchain[dspn].d_w[i] = va_arg(ap, t_int);
+    va_end(ap);
+    dspn++;
+}
+
+static t_int *zero_perform(t_int *w)
+{
+    memset((t_sample *)(w[1]), 0, (int)(w[2]) * sizeof(t_sample));
+    return (w+3);
+}
+
+void dsp_add_zero(t_sample *vec, int n)
+{
+    dsp_add(zero_perform, 2, (t_int)vec, (t_int)n);
+}
+
+/* a signal of nchans channels for the chain being built, freed by
+   bench_freechain */
+static t_signal *bench_newsignal(int nchans)
+{
+    t_signal *s;
+    if (nsignals == MAXSIGNALS)
+    {
+        fprintf(stderr, "bench: too many signals\n");
+        exit(1);
+    }
+    s = (t_signal *)getbytes(sizeof(*s));
+    s->s_n = benchn;
+    s->s_sr = benchsr;
+    s->s_nchans = nchans;
+    s->s_vec = (t_sample *)getbytes(benchn * nchans * sizeof(t_sample));
+    return (signals[nsignals++] = s);
+}
+
+/* as in Pd, the outlet gets a new signal in place of the one the dsp
+   method was given */
+void signal_setmultiout(t_signal **sig, int nchans)
+{
+    *sig = bench_newsignal(nchans);
+}
+
+void canvas_update_dsp(void)
+{
+}
+
+static void bench_runchain(void)
+{
+    int i;
+    for (i = 0; i < dspn; i++)
+        (*(t_perfroutine)dspchain[i].d_w[0])(dspchain[i].d_w);
+}
+
+static void bench_freechain(void)
+{
+    int i;
+    for (i = 0; i < nsignals; i++)
+    {
+        freebytes(signals[i]->s_vec, 0);
+        freebytes(signals[i], 0);
+    }
+    nsignals = noutputs = dspn = 0;
+}
+
+/* -------------------------- messages ------------------------------- */
+
+static t_methodentry *bench_findmethod(t_pd *x, t_symbol *sel)
+{
+    int i;
+    for (i = 0; i < (*x)->c_nmethods; i++)
+        if ((*x)->c_methods[i].me_sel == sel)
+            return (&(*x)->c_methods[i]);
+    return (0);
+}
+
+/* call a method the way pd_typedmess would, for the argument lists the
+   four externals use: none, one or two floats, one symbol or A_GIMME */
+static void bench_typedmess(t_pd *x, t_symbol *sel, int argc, t_atom *argv)
+{
+    t_methodentry *m = bench_findmethod(x, sel);
+    t_atomtype *a;
+    if (!m)
+    {
+        fprintf(stderr, "bench: %s: no method for %s\n",
+            (*x)->c_name->s_name, sel->s_name);
+        return;
+    }
+    a = m->me_args;
+    if (a[0] == A_GIMME)
+        ((void (*)(t_pd *, t_symbol *, int, t_atom *))m->me_fn)(x, sel,
+            argc, argv);
+    else if (a[0] == A_NULL)
+        ((void (*)(t_pd *))m->me_fn)(x);
+    else if (a[0] == A_SYMBOL || a[0] == A_DEFSYM)
+        ((void (*)(t_pd *, t_symbol *))m->me_fn)(x,
+            atom_getsymbolarg(0, argc, argv));
+    else if ((a[0] == A_FLOAT || a[0] == A_DEFFLOAT) && a[1] == A_NULL)
+        ((void (*)(t_pd *, t_floatarg))m->me_fn)(x,
+            atom_getfloatarg(0, argc, argv));
+    else if ((a[0] == A_FLOAT || a[0] == A_DEFFLOAT)
+        && (a[1] == A_FLOAT || a[1] == A_DEFFLOAT) && a[2] == A_NULL)
+        ((void (*)(t_pd *, t_floatarg, t_floatarg))m->me_fn)(x,
+            atom_getfloatarg(0, argc, argv), atom_getfloatarg(1, argc, argv));
+    else fprintf(stderr, "bench: %s: can't call %s\n",
+        (*x)->c_name->s_name, sel->s_name);
+}
+
+/* send a message written as text, "selector arg arg ..." */
+static void bench_sendtext(t_pd *x, const char *text)
+{
+    char buf[1024], *tok, *end;
+    t_atom av[256];
+    int ac = 0;
+    t_symbol *sel;
+    strncpy(buf, text, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    if (!(tok = strtok(buf, " ")))
+        return;
+    sel = gensym(tok);
+    while ((tok = strtok(0, " ")) && ac < 256)
+    {
+        double f = strtod(tok, &end);
+        if (*end)
+            SETSYMBOL(&av[ac], gensym(tok));
+        else SETFLOAT(&av[ac], f);
+        ac++;
+    }
+    bench_typedmess(x, sel, ac, av);
+}
+
+/* ------------------------- the benchmark --------------------------- */
+
+void fumio_tilde_setup(void);
+void ota_tilde_setup(void);
+void ring64_tilde_setup(void);
+void zdsv_tilde_setup(void);
+
+#define PARAM_NONE 0
+#define PARAM_OVERSAMPLE 1
+#define PARAM_BANDS 2
+
+typedef struct _benchext
+{
+    const char *e_name;
+    void (*e_setup)(void);
+    int e_nin, e_nout; // signal inlets and outlets
+    t_float e_cutlo, e_cuthi; // swept at the cutoff inlet
+    t_float e_reslo, e_reshi; // and at the resonance inlet
+    int e_param; // PARAM_*, what the third sweep sets
+    int e_modes; // takes mode 1..3
+    double e_tolerance; // dB below the reference peak, see bench_check
+    int e_run; // selected with -x
+} t_benchext;
+
+    /* ota~ runs into self oscillation at the top of its resonance ramp,
+       where rounding differences grow, hence its looser tolerance */
+static t_benchext benchexts[] = {
+    {"fumio~", fumio_tilde_setup, 3, 1, 50, 8000, 0, 2.5,
+        PARAM_OVERSAMPLE, 1, -90, 1},
+    {"ota~", ota_tilde_setup, 3, 1, 50, 8000, 0, 4.5,
+        PARAM_OVERSAMPLE, 0, -70, 1},
+    {"ring64~", ring64_tilde_setup, 4, 1, 50, 1000, 50, 2000,
+        PARAM_BANDS, 0, -100, 1},
+    {"zdsv~", zdsv_tilde_setup, 3, 3, 50, 15000, 0, 99,
+        PARAM_NONE, 0, -100, 1},
+};
+#define NEXTS (int)(sizeof(benchexts) / sizeof(benchexts[0]))
+
+#define INPUT_NOISE 0
+#define INPUT_IMPULSE 1
+#define INPUT_SWEEP 2
+static const char *inputnames[] = {"noise", "impulse", "sweep"};
+
+/* -v: each case again with a message that takes another code path. A
+   V_REF variant is a case of its own with its own reference. The others
+   claim to give the output of the plain case and are checked against it
+   in the same process, with -g or without: V_SAME sample for sample,
+   V_LATE one block late (batch) and V_CHAN0 in the first channel of a
+   multichannel signal. v_nchans and v_nobjects override -c and -k for
+   the variant and its plain case, so that the lanes fill up. */
+#define V_REF 0
+#define V_SAME 1
+#define V_LATE 2
+#define V_CHAN0 3
+
+typedef struct _benchvariant
+{
+    const char *v_ext;
+    const char *v_msg; // 0 for none
+    int v_input; // INPUT_*, the variant runs with this input only
+    int v_kind; // V_*
+    int v_nchans, v_nobjects; // 0 for -c and -k
+} t_benchvariant;
+
+static t_benchvariant benchvariants[] = {
+    {"fumio~", "quality 1", INPUT_NOISE, V_REF, 0, 0},
+    {"fumio~", "quality 2", INPUT_NOISE, V_REF, 0, 0},
+    {"fumio~", "solver adaptive", INPUT_SWEEP, V_REF, 0, 0},
+    {"fumio~", "solver implicit", INPUT_SWEEP, V_REF, 0, 0},
+    {"fumio~", "antialias 1", INPUT_SWEEP, V_REF, 0, 0},
+    {"fumio~", "sleep 1e-05", INPUT_IMPULSE, V_REF, 0, 0},
+    {"fumio~", "batch 1", INPUT_NOISE, V_LATE, 0, 5},
+    {"fumio~", 0, INPUT_NOISE, V_CHAN0, 5, 0},
+    {"ota~", "quality 1", INPUT_NOISE, V_REF, 0, 0},
+    {"ota~", "quality 2", INPUT_NOISE, V_REF, 0, 0},
+    {"ota~", "solver adaptive", INPUT_SWEEP, V_REF, 0, 0},
+    {"ota~", "solver implicit", INPUT_SWEEP, V_REF, 0, 0},
+    {"ota~", "antialias 1", INPUT_SWEEP, V_REF, 0, 0},
+    {"ota~", "sleep 1e-05", INPUT_IMPULSE, V_REF, 0, 0},
+    {"ota~", "simd 0", INPUT_NOISE, V_SAME, 0, 0},
+    {"ota~", "batch 1", INPUT_NOISE, V_LATE, 0, 5},
+    {"ota~", 0, INPUT_NOISE, V_CHAN0, 5, 0},
+    {"ring64~", "engine modal", INPUT_NOISE, V_REF, 0, 0},
+    {"ring64~", "coeffrate 1", INPUT_SWEEP, V_REF, 0, 0},
+    {"ring64~", "coeffrate 16", INPUT_SWEEP, V_REF, 0, 0},
+    {"ring64~", "sleep 1e-05", INPUT_IMPULSE, V_REF, 0, 0},
+    {"ring64~", "threads 4", INPUT_NOISE, V_SAME, 0, 0},
+    {"ring64~", "isa scalar", INPUT_NOISE, V_SAME, 0, 0},
+    {"ring64~", 0, INPUT_NOISE, V_CHAN0, 3, 0},
+    {"zdsv~", "coeffrate 1", INPUT_SWEEP, V_REF, 0, 0},
+    {"zdsv~", "coeffrate 16", INPUT_SWEEP, V_REF, 0, 0},
+    {"zdsv~", "sleep 1e-05", INPUT_IMPULSE, V_REF, 0, 0},
+    {"zdsv~", "batch 1", INPUT_NOISE, V_LATE, 0, 5},
+    {"zdsv~", 0, INPUT_NOISE, V_CHAN0, 5, 0},
+};
+#define NVARIANTS (int)(sizeof(benchvariants) / sizeof(benchvariants[0]))
+
+#define MAXLIST 64
+#define MAXCHANS 64
+#define MAXMSGS 32
+
+typedef struct _benchopts
+{
+    int o_inputs[MAXLIST], o_ninputs;
+    int o_blocks[MAXLIST], o_nblocks;
+    int o_rates[MAXLIST], o_nrates;
+    int o_overs[MAXLIST], o_novers;
+    int o_bands[MAXLIST], o_nbands;
+    int o_modes[MAXLIST], o_nmodes;
+    int o_nchans;
+    int o_nobjects;
+    double o_seconds;
+    int o_runs;
+    int o_hold; // blocks the parameters hold still for, 0 for a sweep
+    int o_counters; // -C
+    const char *o_msgs[MAXMSGS];
+    int o_nmsgs;
+    const char *o_after[MAXMSGS];
+    int o_nafter;
+    const char *o_write; // directory to write references to
+    const char *o_check; // directory to check against
+    double o_tolerance; // dB, 0 for the tolerance of each external
+    double o_slower; // percent slower than the reference that fails
+    int o_variants; // -v
+} t_benchopts;
+
+/* one case of the sweep */
+typedef struct _benchcase
+{
+    t_benchext *c_ext;
+    int c_input; // INPUT_*
+    int c_n; // block size
+    int c_sr;
+    int c_param; // oversample or bands, see e_param
+    int c_mode; // fumio~ mode, 0 for the others
+    char c_name[96]; // names the reference files
+} t_benchcase;
+
+/* what a run does with the output besides taking its peak: write it to
+   a reference file or compare it with one. Without g_fp the reference is
+   kept in g_buf, for the variants checked against their plain case */
+typedef struct _golden
+{
+    FILE *g_fp;
+    int g_write;
+    double g_maxdiff; // largest difference from the reference
+    double g_refpeak;
+    int g_short; // the reference ended early
+    t_sample *g_buf;
+    size_t g_len, g_size, g_pos;
+    size_t g_late; // samples the output runs behind the reference
+    int g_chan0; // compare the first channel of each outlet only
+} t_golden;
+
+static double bench_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return ((double)count.QuadPart / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+#endif
+}
+
+/* -C: cache misses counted by the kernel while the chain runs. The
+   counters are inherited by the threads created after they are opened,
+   the workers of ring64~ among them. countfds stay -1 where they can't
+   be opened: not Linux, no such event on the cpu, or perf_event_paranoid
+   above what the user may do */
+#define NCOUNTERS 2
+static const char *countnames[NCOUNTERS] = {"L1D", "LLC"};
+static int countfds[NCOUNTERS] = {-1, -1};
+
+static void bench_opencounters(void)
+{
+#ifdef HAVE_PERF
+    static const unsigned int types[NCOUNTERS] =
+        {PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+    static const unsigned long long configs[NCOUNTERS] = {
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES};
+    struct perf_event_attr pe;
+    int i;
+    for (i = 0; i < NCOUNTERS; i++)
+    {
+        memset(&pe, 0, sizeof(pe));
+        pe.type = types[i];
+        pe.size = sizeof(pe);
+        pe.config = configs[i];
+        pe.disabled = 1;
+        pe.inherit = 1;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        countfds[i] = (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+        if (countfds[i] < 0)
+            fprintf(stderr, "bench: can't count %s misses here\n",
+                countnames[i]);
+    }
+#else
+    fprintf(stderr, "bench: no cache counters on this system\n");
+#endif
+}
+
+/* start (on 1) or stop the counters, reset clears them */
+static void bench_counters(int on, int reset)
+{
+#ifdef HAVE_PERF
+    int i;
+    for (i = 0; i < NCOUNTERS; i++)
+        if (countfds[i] >= 0)
+        {
+            if (reset)
+                ioctl(countfds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(countfds[i], (on ? PERF_EVENT_IOC_ENABLE :
+                PERF_EVENT_IOC_DISABLE), 0);
+        }
+#endif
+}
+
+/* the count since the last reset, -1 if there is none */
+static double bench_readcounter(int i)
+{
+#ifdef HAVE_PERF
+    unsigned long long v;
+    if (countfds[i] >= 0 && read(countfds[i], &v, sizeof(v)) == sizeof(v))
+        return ((double)v);
+#endif
+    return (-1);
+}
+
+static t_class *bench_findclass(const char *name)
+{
+    t_class *c;
+    for (c = classlist; c; c = c->c_next)
+        if (!strcmp(c->c_name->s_name, name))
+            return (c);
+    return (0);
+}
+
+/* band multipliers spaced evenly in pitch over four octaves, so that the
+   top band stays below Nyquist at the highest cutoff */
+static void bench_setbands(t_pd *x, int nbands)
+{
+    t_atom *av = (t_atom *)getbytes(nbands * sizeof(t_atom));
+    int i;
+    SETFLOAT(av, nbands);
+    bench_typedmess(x, gensym("bands"), 1, av);
+    for (i = 0; i < nbands; i++)
+        SETFLOAT(&av[i], pow(16., (nbands > 1 ? i / (nbands - 1.) : 0)));
+    bench_typedmess(x, gensym("freqs"), nbands, av);
+    for (i = 0; i < nbands; i++)
+        SETFLOAT(&av[i], 1. / (1 + i % 4));
+    bench_typedmess(x, gensym("gains"), nbands, av);
+    freebytes(av, nbands * sizeof(t_atom));
+}
+
+static void bench_sendfloat(t_pd *x, const char *sel, t_float f)
+{
+    t_atom a;
+    SETFLOAT(&a, f);
+    bench_typedmess(x, gensym(sel), 1, &a);
+}
+
+/* write the outputs of a block to the reference, or compare them with it */
+static void bench_golden(t_golden *g, t_sample *vec, int n)
+{
+    float ref[1024];
+    int i, m;
+    if (!g->g_fp)
+    {
+        if (g->g_write)
+        {
+            if (g->g_len + n > g->g_size)
+            {
+                size_t size = 2 * (g->g_len + n);
+                g->g_buf = (t_sample *)resizebytes(g->g_buf,
+                    g->g_size * sizeof(t_sample), size * sizeof(t_sample));
+                g->g_size = size;
+            }
+            memcpy(g->g_buf + g->g_len, vec, n * sizeof(t_sample));
+            g->g_len += n;
+            return;
+        }
+        for (i = 0; i < n; i++, g->g_pos++)
+        {
+            double r = 0;
+            if (g->g_pos >= g->g_late + g->g_len)
+            {
+                g->g_short = 1;
+                return;
+            }
+            if (g->g_pos >= g->g_late)
+                r = g->g_buf[g->g_pos - g->g_late];
+            if (fabs(vec[i] - r) > g->g_maxdiff)
+                g->g_maxdiff = fabs(vec[i] - r);
+            if (fabs(r) > g->g_refpeak)
+                g->g_refpeak = fabs(r);
+        }
+        return;
+    }
+    if (g->g_write)
+    {
+        for (; n > 0; n -= m, vec += m)
+        {
+            m = (n < 1024 ? n : 1024);
+            for (i = 0; i < m; i++)
+                ref[i] = vec[i];
+            fwrite(ref, sizeof(float), m, g->g_fp);
+        }
+        return;
+    }
+    for (; n > 0; n -= m, vec += m)
+    {
+        m = (n < 1024 ? n : 1024);
+        if ((int)fread(ref, sizeof(float), m, g->g_fp) < m)
+        {
+            g->g_short = 1;
+            return;
+        }
+        for (i = 0; i < m; i++)
+        {
+            if (fabs(vec[i] - ref[i]) > g->g_maxdiff)
+                g->g_maxdiff = fabs(vec[i] - ref[i]);
+            if (fabs(ref[i]) > g->g_refpeak)
+                g->g_refpeak = fabs(ref[i]);
+        }
+    }
+}
+
+/* one run of one case: make the objects, run the chain over the signal
+   and return the seconds spent in it. *peak gets the output peak; with g
+   the output also goes through bench_golden. v is the variant or 0.
+   after sends the -a messages at the end. With -C, misses gets the counts
+   of the run, see bench_readcounter */
+static double bench_run(t_benchcase *bc, t_benchopts *o, t_benchvariant *v,
+    t_float *peak, t_golden *g, int after, double *misses)
+{
+    t_benchext *e = bc->c_ext;
+    t_class *c = bench_findclass(e->e_name);
+    int n = bc->c_n, sr = bc->c_sr, input = bc->c_input;
+    int nch = (v && v->v_nchans ? v->v_nchans : o->o_nchans);
+    int nobj = (v && v->v_nobjects ? v->v_nobjects : o->o_nobjects);
+    int nsig = e->e_nin + e->e_nout;
+    int nblocks = (int)(o->o_seconds * sr / n), total;
+    t_signal sigs[8], *sp[8];
+    t_pd **objs;
+    unsigned int seed[MAXCHANS];
+    double phase = 0, elapsed = 0, t0;
+    int i, j, k, b, ch;
+
+    if (nblocks < 1)
+        nblocks = 1;
+    total = nblocks * n;
+    *peak = 0;
+    benchn = n;
+    benchsr = sr;
+    objs = (t_pd **)getbytes(nobj * sizeof(t_pd *));
+    for (k = 0; k < nobj; k++)
+    {
+        if (c->c_arg == A_DEFFLOAT)
+            objs[k] = (t_pd *)((void *(*)(t_floatarg))c->c_new)(0);
+        else objs[k] = (t_pd *)(*c->c_new)();
+        if (!objs[k])
+        {
+            fprintf(stderr, "bench: can't create %s\n", e->e_name);
+            nobj = k;
+            break;
+        }
+        if (bc->c_mode)
+            bench_sendfloat(objs[k], "mode", bc->c_mode);
+        for (i = 0; i < o->o_nmsgs; i++)
+            bench_sendtext(objs[k], o->o_msgs[i]);
+        if (v && v->v_msg)
+            bench_sendtext(objs[k], v->v_msg);
+        if (e->e_param == PARAM_OVERSAMPLE)
+            bench_sendfloat(objs[k], "oversample", bc->c_param);
+        else if (e->e_param == PARAM_BANDS)
+            bench_setbands(objs[k], bc->c_param);
+    }
+
+        /* the inlets are shared by all objects, each object gets its own
+           outlets of nch channels like Pd gives them, whether or not its dsp
+           method replaces them with signal_setmultiout. nsig signals for
+           every object, inputs first */
+    for (i = 0; i < e->e_nin; i++)
+    {
+        sigs[i].s_n = n;
+        sigs[i].s_sr = sr;
+        sigs[i].s_nchans = nch;
+        sigs[i].s_vec = (t_sample *)getbytes(n * nch * sizeof(t_sample));
+    }
+    for (k = 0; k < nobj; k++)
+    {
+        for (i = 0; i < e->e_nin; i++)
+            sp[i] = &sigs[i];
+        for (i = e->e_nin; i < nsig; i++)
+            sp[i] = bench_newsignal(nch);
+        ((void (*)(t_pd *, t_signal **))bench_findmethod(objs[k],
+            gensym("dsp"))->me_fn)(objs[k], sp);
+        for (i = e->e_nin; i < nsig; i++)
+            outputs[noutputs++] = sp[i];
+    }
+    for (ch = 0; ch < nch; ch++)
+        seed[ch] = 1 + 7919 * ch;
+    if (o->o_counters)
+        bench_counters(0, 1);
+
+    for (b = 0; b < nblocks; b++)
+    {
+        t_sample *in = sigs[0].s_vec;
+        for (ch = 0; ch < nch; ch++)
+        {
+            double spread = 1 + 0.1 * ch;
+            for (i = 0; i < n; i++)
+            {
+                int t = b * n + i;
+                double ph = (double)t / total, pph = (o->o_hold ?
+                    (double)(b - b % o->o_hold) * n / total : ph);
+                t_sample *v = in + ch * n + i;
+                if (input == INPUT_NOISE)
+                {
+                    seed[ch] = seed[ch] * 1664525u + 1013904223u;
+                    *v = ((seed[ch] >> 8) / 8388608.0 - 1.0) * 0.5;
+                }
+                else if (input == INPUT_IMPULSE)
+                    *v = ((t + 37 * ch) % (sr / 10) == 0);
+                else
+                {
+                    if (ch == 0)
+                        phase += 2 * 3.14159265358979 * 20
+                            * pow(sr * 0.45 / 20, ph) / sr;
+                    *v = 0.5 * sin(phase * spread);
+                }
+                sigs[1].s_vec[ch * n + i] = e->e_cutlo
+                    * pow(e->e_cuthi / e->e_cutlo, pph) * spread;
+                sigs[2].s_vec[ch * n + i] = e->e_reslo
+                    + (e->e_reshi - e->e_reslo) * pph;
+                if (e->e_nin > 3)
+                    sigs[3].s_vec[ch * n + i] = pph - 0.5;
+            }
+        }
+        if (o->o_counters)
+            bench_counters(1, 0);
+        t0 = bench_now();
+        bench_runchain();
+        elapsed += bench_now() - t0;
+        if (o->o_counters)
+            bench_counters(0, 0);
+        for (i = 0; i < noutputs; i++)
+        {
+            t_sample *vec = outputs[i]->s_vec;
+            for (j = 0; j < n * outputs[i]->s_nchans; j++)
+                if (fabs(vec[j]) > *peak)
+                    *peak = fabs(vec[j]);
+            if (g)
+                bench_golden(g, vec, n * (g->g_chan0 ? 1 :
+                    outputs[i]->s_nchans));
+        }
+    }
+
+    for (i = 0; i < NCOUNTERS && o->o_counters; i++)
+        misses[i] = bench_readcounter(i);
+    for (k = 0; k < nobj; k++)
+    {
+        for (i = 0; i < (after ? o->o_nafter : 0); i++)
+            bench_sendtext(objs[k], o->o_after[i]);
+        pd_free(objs[k]);
+    }
+    freebytes(objs, 0);
+    for (i = 0; i < e->e_nin; i++)
+        freebytes(sigs[i].s_vec, 0);
+    bench_freechain();
+    return (elapsed);
+}
+
+/* the reference time of a case from times.txt in the check directory,
+   0 if there is none */
+static double bench_reftime(t_benchopts *o, const char *name)
+{
+    char path[1024], line[256], casename[128];
+    double ns = 0, t;
+    FILE *fp;
+    snprintf(path, sizeof(path), "%s/times.txt", o->o_check);
+    if (!(fp = fopen(path, "r")))
+        return (0);
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "%127s %lf", casename, &t) == 2
+            && !strcmp(casename, name))
+                ns = t;
+    fclose(fp);
+    return (ns);
+}
+
+/* run a case and print its line. With -w the first run writes the
+   reference render and the time goes to times.txt; with -c the first
+   run is compared with the reference. A variant other than V_REF is
+   compared with its plain case instead, see benchvariants. Returns 1 if
+   the check failed */
+static int bench_case(t_benchcase *bc, t_benchopts *o, t_benchvariant *v)
+{
+    t_benchext *e = bc->c_ext;
+    double best = 0, t, ns, nsamples, reftime, tolerance;
+    double misses[NCOUNTERS], bestmisses[NCOUNTERS];
+    t_float peak = 0;
+    t_golden golden, *g = 0;
+    char path[1024], name[192], what[64] = "", result[96] = "",
+        counts[64] = "";
+    int i, r, failed = 0, samples = (int)(o->o_seconds * bc->c_sr / bc->c_n)
+        * bc->c_n;
+    int nch = (v && v->v_nchans ? v->v_nchans : o->o_nchans);
+    int nobj = (v && v->v_nobjects ? v->v_nobjects : o->o_nobjects);
+    int same = (v && v->v_kind != V_REF);
+    FILE *fp;
+
+    if (samples < bc->c_n)
+        samples = bc->c_n;
+    strcpy(name, bc->c_name);
+    if (v && v->v_kind == V_REF)
+    {
+            /* "ring64~-...-1obj-coeffrate_16" */
+        char *s = name + strlen(name);
+        snprintf(s, sizeof(name) - strlen(name), "-%s", v->v_msg);
+        for (; *s; s++)
+            if (*s == ' ')
+                *s = '_';
+    }
+    if (same)
+    {
+            /* the plain case goes to memory first */
+        t_benchvariant plain = *v;
+        plain.v_msg = 0;
+        plain.v_nchans = (v->v_kind == V_CHAN0 ? 1 : v->v_nchans);
+        memset(&golden, 0, sizeof(golden));
+        golden.g_write = 1;
+        bench_run(bc, o, &plain, &peak, &golden, 0, misses);
+        golden.g_write = 0;
+        golden.g_chan0 = (v->v_kind == V_CHAN0);
+        if (v->v_kind == V_LATE)
+            golden.g_late = (size_t)bc->c_n * e->e_nout * nch * nobj;
+        g = &golden;
+    }
+    else if (o->o_write || o->o_check)
+    {
+        snprintf(path, sizeof(path), "%s/%s.raw",
+            (o->o_write ? o->o_write : o->o_check), name);
+        memset(&golden, 0, sizeof(golden));
+        golden.g_write = (o->o_write != 0);
+        if (!(golden.g_fp = fopen(path, (o->o_write ? "wb" : "rb"))))
+        {
+            fprintf(stderr, "bench: %s: can't open\n", path);
+            return (1);
+        }
+        g = &golden;
+    }
+    for (r = 0; r < o->o_runs; r++)
+        if ((t = bench_run(bc, o, v, &peak, (r ? 0 : g),
+            r == o->o_runs - 1, misses)) < best || !r)
+    {
+        best = t;
+        memcpy(bestmisses, misses, sizeof(misses));
+    }
+    nsamples = (double)samples * nch * nobj;
+    ns = 1e9 * best / nsamples;
+    for (i = 0; i < NCOUNTERS && o->o_counters; i++)
+    {
+        if (bestmisses[i] < 0)
+            sprintf(counts + strlen(counts), "  %s n/a", countnames[i]);
+        else sprintf(counts + strlen(counts), "  %s %.3f", countnames[i],
+            bestmisses[i] / nsamples);
+    }
+
+    if (same)
+    {
+            /* these claim the plain output, so nothing but exact passes */
+        if (golden.g_short || golden.g_pos != golden.g_len)
+            strcpy(result, "FAIL length"), failed = 1;
+        else if (golden.g_maxdiff > 0)
+            sprintf(result, "FAIL off by %.3g", golden.g_maxdiff), failed = 1;
+        else strcpy(result, "ok same");
+        freebytes(golden.g_buf, golden.g_size * sizeof(t_sample));
+    }
+    else if (o->o_write)
+    {
+        fclose(golden.g_fp);
+        snprintf(path, sizeof(path), "%s/times.txt", o->o_write);
+        if ((fp = fopen(path, "a")))
+        {
+            fprintf(fp, "%s %.3f\n", name, ns);
+            fclose(fp);
+        }
+        strcpy(result, "written");
+    }
+    else if (o->o_check)
+    {
+        double db;
+        if (getc(golden.g_fp) != EOF)
+            golden.g_short = 1;
+        fclose(golden.g_fp);
+        tolerance = (o->o_tolerance != 0 ? o->o_tolerance : e->e_tolerance);
+        db = (golden.g_maxdiff == 0 ? -INFINITY : golden.g_refpeak > 0 ?
+            20 * log10(golden.g_maxdiff / golden.g_refpeak) : INFINITY);
+        if (golden.g_short)
+            strcpy(result, "FAIL length"), failed = 1;
+        else if (db > tolerance)
+            sprintf(result, "FAIL %.1f dB", db), failed = 1;
+        else if (db == -INFINITY)
+            strcpy(result, "ok exact");
+        else sprintf(result, "ok %.1f dB", db);
+        reftime = bench_reftime(o, name);
+        if (o->o_slower > 0 && reftime > 0
+            && ns > reftime * (1 + o->o_slower / 100))
+        {
+            sprintf(result + strlen(result), ", FAIL %.0f%% slower",
+                100 * (ns / reftime - 1));
+            failed = 1;
+        }
+    }
+
+    if (e->e_param == PARAM_OVERSAMPLE)
+        sprintf(what, "over %d", bc->c_param);
+    else if (e->e_param == PARAM_BANDS)
+        sprintf(what, "bands %d", bc->c_param);
+    if (bc->c_mode)
+        sprintf(what + strlen(what), " mode %d", bc->c_mode);
+    if (v)
+    {
+        char *s = what + strlen(what);
+        snprintf(s, sizeof(what) - strlen(what), "%s[%s", (*what ? " " : ""),
+            (v->v_msg ? v->v_msg : ""));
+        if (v->v_kind == V_CHAN0)
+            sprintf(what + strlen(what), "%d channels", nch);
+        if (v->v_kind == V_LATE)
+            sprintf(what + strlen(what), ", %d objects", nobj);
+        strcat(what, "]");
+    }
+    printf("%-8s sr %6d block %5d %-16s %-8s %9.2f ns/sample %8.3f "
+        "Msamples/s%s  peak %.3g%s%s\n", e->e_name, bc->c_sr, bc->c_n, what,
+        inputnames[bc->c_input], ns, 1e3 / ns, counts, peak,
+        (*result ? "  " : ""), result);
+    fflush(stdout);
+    return (failed);
+}
+
+/* "64,1024" into list, returns the count */
+static int bench_parselist(const char *s, int *list)
+{
+    int n = 0;
+    char *end;
+    while (*s && n < MAXLIST)
+    {
+        list[n] = (int)strtol(s, &end, 10);
+        if (end == s)
+            break;
+        n++;
+        s = (*end == ',' ? end + 1 : end);
+    }
+    return (n);
+}
+
+/* "noise,sweep" into list of INPUT_* or -x names into e_run */
+static int bench_parsenames(const char *s, int *list)
+{
+    char buf[256], *tok;
+    int n = 0, i;
+    strncpy(buf, s, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    for (tok = strtok(buf, ","); tok; tok = strtok(0, ","))
+    {
+        int found = 0;
+        if (list)
+        {
+            for (i = 0; i < 3; i++)
+                if (!strcmp(tok, inputnames[i]) && n < MAXLIST)
+                    list[n++] = i, found = 1;
+        }
+        else for (i = 0; i < NEXTS; i++)
+            if (!strncmp(tok, benchexts[i].e_name, strlen(tok)))
+                benchexts[i].e_run = found = 1, n++;
+        if (!found)
+            fprintf(stderr, "bench: unknown name %s\n", tok);
+    }
+    return (n);
+}
+
+static void bench_usage(void)
+{
+    fprintf(stderr, "usage: bench [-x externals] [-i inputs] [-b blocks] "
+        "[-r rates] [-o oversample] [-B bands] [-M modes] [-c channels] "
+        "[-k objects] [-s seconds] [-R runs] [-H blocks] [-C] [-v] "
+        "[-m message]... [-a message]... "
+        "[-w dir | -g dir [-e dB] [-p percent]]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static t_benchopts opts = {
+        {INPUT_NOISE, INPUT_IMPULSE, INPUT_SWEEP}, 3,
+        {64, 1024}, 2, {44100, 96000}, 2, {1, 2, 4}, 3, {16, 64, 256}, 3,
+        {1, 2, 3}, 3, 1, 1, 1, 3, 0, 0, {0}, 0, {0}, 0, 0, 0, 0, 25};
+    t_benchopts *o = &opts;
+    t_benchcase bc;
+    int i, e, in, b, r, p, m, k, failures = 0, ncases = 0;
+    char path[1024];
+
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = (i + 1 < argc ? argv[i + 1] : 0);
+        if (!strcmp(argv[i], "-C"))
+        {
+            o->o_counters = 1;
+            continue;
+        }
+        if (!strcmp(argv[i], "-v"))
+        {
+            o->o_variants = 1;
+            continue;
+        }
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || !arg)
+            bench_usage();
+        switch (argv[i++][1])
+        {
+        case 'x':
+            for (e = 0; e < NEXTS; e++)
+                benchexts[e].e_run = 0;
+            bench_parsenames(arg, 0);
+            break;
+        case 'i': o->o_ninputs = bench_parsenames(arg, o->o_inputs); break;
+        case 'b': o->o_nblocks = bench_parselist(arg, o->o_blocks); break;
+        case 'r': o->o_nrates = bench_parselist(arg, o->o_rates); break;
+        case 'o': o->o_novers = bench_parselist(arg, o->o_overs); break;
+        case 'B': o->o_nbands = bench_parselist(arg, o->o_bands); break;
+        case 'M': o->o_nmodes = bench_parselist(arg, o->o_modes); break;
+        case 'c': o->o_nchans = atoi(arg); break;
+        case 'k': o->o_nobjects = atoi(arg); break;
+        case 's': o->o_seconds = atof(arg); break;
+        case 'R': o->o_runs = atoi(arg); break;
+        case 'H': o->o_hold = atoi(arg); break;
+        case 'm':
+            if (o->o_nmsgs < MAXMSGS)
+                o->o_msgs[o->o_nmsgs++] = arg;
+            break;
+        case 'a':
+            if (o->o_nafter < MAXMSGS)
+                o->o_after[o->o_nafter++] = arg;
+            break;
+        case 'w': o->o_write = arg; break;
+        case 'g': o->o_check = arg; break;
+        case 'e': o->o_tolerance = atof(arg); break;
+        case 'p': o->o_slower = atof(arg); break;
+        default: bench_usage();
+        }
+    }
+    if (o->o_nchans < 1 || o->o_nchans > MAXCHANS || o->o_nobjects < 1
+        || o->o_runs < 1 || o->o_seconds <= 0 || o->o_hold < 0
+        || (o->o_write && o->o_check))
+            bench_usage();
+    for (b = 0; b < o->o_nblocks; b++)
+        if (o->o_blocks[b] < 1)
+            bench_usage();
+    if (o->o_write)
+    {
+            /* times.txt is appended to case by case, start it afresh */
+        snprintf(path, sizeof(path), "%s/times.txt", o->o_write);
+        remove(path);
+    }
+
+    if (o->o_counters)
+        bench_opencounters();
+    for (e = 0; e < NEXTS; e++)
+        (*benchexts[e].e_setup)();
+    for (e = 0; e < NEXTS; e++)
+    {
+        t_benchext *x = &benchexts[e];
+        int *params = (x->e_param == PARAM_OVERSAMPLE ? o->o_overs :
+            x->e_param == PARAM_BANDS ? o->o_bands : 0);
+        int nparams = (x->e_param == PARAM_OVERSAMPLE ? o->o_novers :
+            x->e_param == PARAM_BANDS ? o->o_nbands : 1);
+        int nmodes = (x->e_modes ? o->o_nmodes : 1);
+        if (!x->e_run)
+            continue;
+        bc.c_ext = x;
+        for (r = 0; r < o->o_nrates; r++)
+            for (b = 0; b < o->o_nblocks; b++)
+                for (p = 0; p < nparams; p++)
+                    for (m = 0; m < nmodes; m++)
+                        for (in = 0; in < o->o_ninputs; in++)
+        {
+            bc.c_input = o->o_inputs[in];
+            bc.c_n = o->o_blocks[b];
+            bc.c_sr = o->o_rates[r];
+            bc.c_param = (params ? params[p] : 0);
+            bc.c_mode = (x->e_modes ? o->o_modes[m] : 0);
+            snprintf(bc.c_name, sizeof(bc.c_name), "%s-%d-%d-%d-%d-%s-%dch-%dobj", x->e_name, bc.c_sr, bc.c_n,
+                bc.c_param, bc.c_mode, inputnames[bc.c_input], o->o_nchans,
+                o->o_nobjects);
+            if (o->o_hold)
+                sprintf(bc.c_name + strlen(bc.c_name), "-hold%d", o->o_hold);
+            failures += bench_case(&bc, o, 0);
+            ncases++;
+            for (k = 0; k < NVARIANTS && o->o_variants; k++)
+                if (!strcmp(benchvariants[k].v_ext, x->e_name)
+                    && benchvariants[k].v_input == bc.c_input)
+            {
+                failures += bench_case(&bc, o, &benchvariants[k]);
+                ncases++;
+            }
+        }
+    }
+    if (o->o_check)
+        printf("%d of %d cases failed\n", failures, ncases);
+    return (failures != 0);
+}
@@ -0,0 +1,122 @@
+/* m_pd.h for the offline benchmark: the part of the Pd API the four
+   externals use, with the same names and types as Pd's own m_pd.h.
+   bench.c implements it. Do not build the externals for Pd against this
+   file; it only has what bench needs. */
+
+#ifndef __m_pd_h_
+#define __m_pd_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PD_MAJOR_VERSION 0
+#define PD_MINOR_VERSION 54
+#define EXTERN extern
+
+typedef intptr_t t_int;
+typedef float t_float;
+typedef float t_floatarg;
+typedef float t_sample;
+
+typedef struct _symbol
+{
+    const char *s_name;
+    struct _class **s_thing;
+    struct _symbol *s_next;
+} t_symbol;
+
+typedef struct _class t_class;
+typedef t_class *t_pd;
+typedef struct _outlet t_outlet;
+typedef struct _inlet t_inlet;
+typedef struct _garray t_garray;
+
+typedef union word
+{
+    t_float w_float;
+    t_symbol *w_symbol;
+    int w_index;
+} t_word;
+
+typedef enum
+{
+    A_NULL, A_FLOAT, A_SYMBOL, A_POINTER, A_SEMI, A_COMMA, A_DEFFLOAT,
+    A_DEFSYM, A_DOLLAR, A_DOLLSYM, A_GIMME, A_CANT
+} t_atomtype;
+#define A_DEFSYMBOL A_DEFSYM
+
+typedef struct _atom
+{
+    t_atomtype a_type;
+    union word a_w;
+} t_atom;
+
+typedef struct _object
+{
+    t_pd ob_pd;
+    t_outlet *ob_outlet;
+    t_inlet *ob_inlet;
+} t_object;
+
+typedef void (*t_method)(void);
+typedef void *(*t_newmethod)(void);
+typedef t_int *(*t_perfroutine)(t_int *args);
+
+typedef struct _signal
+{
+    int s_n; // points per channel
+    t_sample *s_vec;
+    t_float s_sr;
+    int s_nchans;
+} t_signal;
+
+extern t_symbol s_signal, s_float, s_symbol, s_bang, s_list, s_;
+
+/* classes and objects */
+#define CLASS_DEFAULT 0
+#define CLASS_MULTICHANNEL 0x100
+t_class *class_new(t_symbol *name, t_newmethod newmethod, t_method freemethod,
+    size_t size, int flags, t_atomtype arg1, ...);
+void class_addmethod(t_class *c, t_method fn, t_symbol *sel,
+    t_atomtype arg1, ...);
+void class_domainsignalin(t_class *c, int onset);
+#define CLASS_MAINSIGNALIN(c, type, field) \
+    class_domainsignalin(c, (int)offsetof(type, field))
+t_symbol *gensym(const char *s);
+t_pd *pd_new(t_class *cls);
+void pd_free(t_pd *x);
+t_pd *pd_findbyclass(t_symbol *s, const t_class *c);
+t_outlet *outlet_new(t_object *owner, t_symbol *s);
+t_inlet *inlet_new(t_object *owner, t_pd *dest, t_symbol *s1, t_symbol *s2);
+
+/* memory */
+void *getbytes(size_t nbytes);
+void *resizebytes(void *old, size_t oldsize, size_t newsize);
+void freebytes(void *x, size_t nbytes);
+
+/* printing */
+void post(const char *fmt, ...);
+void error(const char *fmt, ...);
+void pd_error(const void *object, const char *fmt, ...);
+
+/* atoms */
+#define SETFLOAT(atom, f) ((atom)->a_type = A_FLOAT, (atom)->a_w.w_float = (f))
+#define SETSYMBOL(atom, s) ((atom)->a_type = A_SYMBOL, \
+    (atom)->a_w.w_symbol = (s))
+t_float atom_getfloat(const t_atom *a);
+t_float atom_getfloatarg(int which, int argc, const t_atom *argv);
+t_symbol *atom_getsymbol(const t_atom *a);
+t_symbol *atom_getsymbolarg(int which, int argc, const t_atom *argv);
+
+/* dsp */
+void dsp_add(t_perfroutine f, int n, ...);
+void dsp_add_zero(t_sample *vec, int n);
+void signal_setmultiout(t_signal **sig, int nchans);
+void canvas_update_dsp(void);
+
+/* arrays */
+extern t_class *garray_class;
+int garray_getfloatwords(t_garray *x, int *size, t_word **vec);
+void garray_usedindsp(t_garray *x);
+
+#endif /* __m_pd_h_ */
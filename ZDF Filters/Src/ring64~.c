@@ -1,13 +1,147 @@
-/* ring64~ - A zero delay feedback 64 bands resonator */
+/* ring64~ - A zero delay feedback resonator bank, 64 bands by default */
+/* "ring64~ N" or the bands message give room for any number of bands */
 /* Bandpass filter based on A.Zavalishin "The Art of VA Filter Design 1.1.1"*/
 
 /* copyright 2018 Johannes Regnier - BSD license */
 
 #include "m_pd.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <float.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#define BANDS 64 // default number of bands
+#define MAXBANDS 65536
+#define CACHELINE 64
+
+/* -DSINGLE_PRECISION keeps the band states and coefficients in float, for
+   twice the bands per vector and half the memory. The zdf engine holds
+   up well: against the double build the error is around -55..-60 dB of
+   the signal on 16 and 256 band banks swept 80-2000 Hz, and -75..-85 dB
+   at fixed low cutoffs with the longest decays, while 256 bands run about
+   1.4 times as fast. The modal engine rotates its state by r e^(jw) every
+   sample and a float r, cos w and sin w misplace the pole, so low,
+   long ringing bands detune and decay at the wrong rate (-40 dB on the
+   same sweep). Use the double build for the modal engine or when the
+   bank is to ring for tens of seconds. */
+#ifdef SINGLE_PRECISION
+#define FLOAT float
+#define FLOAT_MIN FLT_MIN
+#else
 #define FLOAT double
-#define BANDS 64
+#define FLOAT_MIN DBL_MIN
+#endif
+
+/* instruction set levels of the band kernels. The vector loops are
+   written once with gcc vector extensions for a 128, 256 and 512 bit
+   register; on x86 the render loop is built for SSE2, AVX2 and AVX-512
+   with target attributes and ring64_dsp picks the widest the cpu runs.
+   Elsewhere there is the 128 bit loop for the build target, and compilers
+   without the extensions (MSVC) only have ISA_SCALAR, the plain per-band
+   loop. The levels sum the bands across different numbers of lanes, so
+   they differ in the last bits of the double sum */
+#ifdef _MSC_VER
+#define FORCEINLINE static __forceinline
+#else
+#define FORCEINLINE static inline __attribute__((always_inline))
+#endif
+#define ISA_SCALAR 0
+#define ISA_SSE2 1 // the vector loop for the build target elsewhere
+#define ISA_AVX2 2
+#define ISA_AVX512 3
+#ifdef __GNUC__
+#define HAVE_VECTORS
+typedef FLOAT t_v128 __attribute__((vector_size(16)));
+typedef FLOAT t_v256 __attribute__((vector_size(32)));
+typedef FLOAT t_v512 __attribute__((vector_size(64)));
+#endif
+#if defined(HAVE_VECTORS) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_DISPATCH
+#define NISA 4
+static const char *isanames[] = {"scalar", "sse2", "avx2", "avx512"};
+#elif defined(HAVE_VECTORS)
+#define NISA 2
+static const char *isanames[] = {"scalar", "vector"};
+#else
+#define NISA 1
+static const char *isanames[] = {"scalar"};
+#endif
+
+/* worker threads for large banks (pthreads and GCC style atomics) */
+#ifndef _MSC_VER
+#define RING64_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+/* flush-to-zero and denormals-are-zero bits of the SSE control register */
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define HAVE_FTZ
+#define FTZ_DAZ 0x8040
+#endif
+#define DENORMAL_OFF 0 // leave subnormals alone
+#define DENORMAL_FTZ 1 // FTZ/DAZ on while the perform routine runs
+#define DENORMAL_OFFSET 2 // tiny alternating offset added to the states
+#define DENORMAL_SNAP 3 // states below DENORMAL_TINY are set to zero
+#define DENORMAL_TINY 1e-30
+
+#define ENGINE_ZDF 0 // 2-pole ZDF bandpass per band
+#define ENGINE_MODAL 1 // complex one-pole resonator per band
+#define PARAM_BLOCK 0 // cutoff and resonance of the first sample
+#define PARAM_AUDIO 1 // exact coefficients every sample
+#define PARAM_INTERP 2 // exact every coeffrate samples, interpolated between
+#define CURVE_LINEAR 0 // gain ramps in a straight line
+#define CURVE_EXP 1 // gain ramps as a one pole glide, 60 dB closer at the end
+#define MAXTHREADS 16
+#define MINPART 32 // fewest bands worth handing to a thread
+#define STATBUCKETS 15 // block times under 1, 2, 4 ... 8192 us and above
+#ifdef HAVE_FTZ
+#define SPIN_PAUSE() _mm_pause()
+#else
+#define SPIN_PAUSE()
+#endif
+
+struct _ring64;
+
+/* what a channel of a multichannel signal keeps between blocks: its own
+   active list, band states and coefficients, see ring64_perform_voices */
+typedef struct _ring64voice
+{
+    FLOAT *v_bp;
+    FLOAT *v_s1;
+    FLOAT *v_s2;
+    FLOAT *v_coefg;
+    FLOAT *v_coefd;
+    FLOAT *v_coefb;
+    FLOAT *v_gainband;
+    FLOAT *v_gainstep;
+    FLOAT *v_slotmult;
+    int *v_active;
+    int v_nactive;
+    int v_dirty;
+    int v_asleep;
+    FLOAT v_activecutoff;
+    FLOAT v_activebrightness;
+    FLOAT v_cutoffold;
+    FLOAT v_resonanceold;
+    FLOAT v_brightnessold;
+    FLOAT v_antidenormal;
+    int v_coefvalid;
+    FLOAT v_coefcutoff;
+    FLOAT v_coefresonance;
+} t_ring64voice;
+
+typedef struct _ring64worker
+{
+#ifdef RING64_THREADS
+    pthread_t w_thread;
+#endif
+    struct _ring64 *w_owner;
+} t_ring64worker;
 
 typedef struct _ring64
 {
@@ -23,43 +157,327 @@ typedef struct _ring64
     FLOAT p_input;
     FLOAT p_cutoff;
     FLOAT cutoffold;
-    FLOAT cutoffincrement;
     FLOAT p_resonance;
     FLOAT resonanceold;
-    FLOAT resonanceincrement;
-    FLOAT p_gainband[BANDS];
-    FLOAT gainbandold[BANDS];
-    FLOAT gainbandincrement[BANDS];
     FLOAT p_brightness;
     FLOAT brightnessold;
     FLOAT brightnessincrement;
 
-    t_int numberbands; // number of active bands
+    t_int numberbands; // number of bands in use
+    t_int maxbands; // number of bands the arena has room for
     t_int softclip;
 
-    FLOAT x_lp[BANDS];
-    FLOAT x_bp[BANDS];
-    FLOAT x_hp[BANDS];
-    FLOAT s1[BANDS];
-    FLOAT s2[BANDS];
+    /* all per-band arrays below are carved from this single block, each one
+       starting on its own cache line. It is (re)allocated by ring64_new and
+       the bands method, never while the DSP is running. */
+    char *arena;
+    size_t arenasize;
+
+    /* per-band parameters, indexed by band. p_gainband is the gain a band
+       is set to and gainbandold the gain it has at the start of the block;
+       they differ while the band ramps, see ring64_glide */
+    FLOAT *p_gainband;
+    FLOAT *gainbandold;
+    FLOAT *gainbandincrement; // per sample, in the block ring64_glide planned
+    FLOAT *gainbandleft; // samples until the ramp ends
+    FLOAT *gainbandcoef; // per sample factor of an exponential ramp, 0: linear
+    FLOAT *freqmult;
+
+    /* gain ramps started by gains, setgains and gain */
+    FLOAT ramptime; // ms, 0 to jump
+    int rampcurve; // CURVE_LINEAR or CURVE_EXP
+    int gliding; // some band ramps, or its last block has yet to be taken in
+    int glidelen; // samples in the block ring64_glide planned last
+
+    /* active bands: not beyond numberbands, not band limited, not muted by a
+       zero entry in gains */
+    int *active; // band index of each slot
+    int nactive;
+    int dirty; // gains, freqs or band count changed since the last rebuild
+    FLOAT activecutoff; // cutoff and brightness the list was built for
+    FLOAT activebrightness;
+
+    /* filter state of the active bands, indexed by slot, one array per field
+       so that consecutive slots fill the lanes of a vector (structure of arrays).
+       The modal engine keeps the real and imaginary part of its resonators
+       in s1 and s2, r cos(w) and r sin(w) in coef_g and coef_d. */
+    int engine; // ENGINE_ZDF or ENGINE_MODAL
+    FLOAT *x_bp;
+    FLOAT *s1;
+    FLOAT *s2;
+    FLOAT *coef_g; // prewarped integrator gain
+    FLOAT *coef_d; // 1/(1 + 2Rg + g^2)
+    FLOAT *coef_b; // modal input gain
+    FLOAT *coef_ginc; // per sample increments when interpolating
+    FLOAT *coef_dinc;
+    FLOAT *coef_binc;
+    FLOAT *gainband; // gain with brightness applied
+    FLOAT *gainstep; // per sample change of gainband while bands ramp
+    FLOAT *slotmult; // freqmult of the band in each slot
+    t_int coeffrate; // 0: once per block, 1: every sample, N: every N samples
+
+    /* the coefficients stay in coef_g, coef_d and coef_b from block to
+       block; they are recomputed only when cutoff or resonance move or
+       ring64_activate has rebuilt the slots */
+    int coefvalid; // coefficients hold coefcutoff and coefresonance
+    FLOAT coefcutoff;
+    FLOAT coefresonance;
+    int recoef; // this block has to recompute them
+    /* PARAM_BLOCK: one set of coefficients for the block. With coeffrate
+       1 or N and a cutoff or resonance inlet that moves within the block,
+       PARAM_AUDIO or PARAM_INTERP follow the clipped parameters of every
+       sample in paramcut and paramres */
+    int paramrate;
+    FLOAT *paramcut;
+    FLOAT *paramres;
+
+    /* scratch for ring64_activate */
+    FLOAT *old_s1;
+    FLOAT *old_s2;
+    FLOAT *old_bp;
+    int *old_slot;
+
+    /* optional garrays holding freqs and gains, read by the perform routine */
+    t_symbol *freqarray;
+    t_symbol *gainarray;
+    t_word *freqvec;
+    t_word *gainvec;
+    int freqvecsize;
+    int gainvecsize;
+
+    /* tail sleep: skip the bank while the input is silent and every band
+       has decayed below sleepthresh (0 = never sleep) */
+    FLOAT sleepthresh;
+    int asleep;
+    long sleepcount; // times the bank went to sleep
+    long sleepblocks; // blocks skipped
+    long totalblocks;
+
+    /* subnormal protection, see DENORMAL_* */
+    int denormal;
+    FLOAT antidenormal; // offset added next block, alternates in sign
+    long denormals; // subnormal band states found at the end of a block
 
-    FLOAT freqmult[BANDS];
-    FLOAT freqband[BANDS];    
-    FLOAT gainband[BANDS];
-    FLOAT singleout[BANDS];
     FLOAT sumout;
     FLOAT gain; // main gain
+
+    /* partitioned processing: the active slots are split into nparts
+       ranges; each range writes its band sum for the block into its own
+       row of sums, and the rows are added in a fixed order afterwards */
+    int nthreads; // threads requested, including the audio thread
+    int nworkers; // helper threads running, in workers at the end
+    int blocksize;
+    FLOAT *sums; // nthreads rows of sumstride samples, cache line aligned
+    char *sumsraw;
+    size_t sumssize;
+    int sumstride;
+    int nparts;
+    int partlo[MAXTHREADS + 1];
+    t_float *blockin; // input vector of the current block
+    /* block ticket: generation << 16 | number of ranges << 8 | next range.
+       Publishing a new generation makes claims on the previous block fail. */
+    volatile unsigned int ticket;
+    volatile int partsdone;
+    volatile int quit;
+#ifdef RING64_THREADS
+    /* idle helpers past their spin and yield wait here, see ring64_park */
+    pthread_mutex_t parklock;
+    pthread_cond_t parkcond;
+    volatile int parked;
+#endif
+
+    /* multichannel: one voice per channel of the left inlet, the cutoff,
+       resonance and brightness inlets have either as many channels or one
+       for all. Band parameters, gains and freqs are shared. Each voice has
+       its own slot arrays in voicearena and is swapped into the fields
+       above for the block, so the bank runs one channel at a time with
+       all its lanes and threads. home keeps the single voice arrays. */
+    int nchans;
+    int cutchans;
+    int reschans;
+    int brightchans;
+    t_ring64voice *voices;
+    t_ring64voice home;
+    char *voicearena;
+    size_t voicearenasize;
+    int voicebands; // maxbands the voice arrays were carved for
+
+    /* instruction set level of the band kernels, see ring64_setisa */
+    int isa;
+    int isamax; // cap set by the isa message, NISA - 1 for none
+    void (*render)(struct _ring64 *x, int lo, int hi, t_float *in,
+        FLOAT *sum, int n);
+
+    /* profile 1: the time each DSP block of this object takes, see
+       ring64_stats */
+    int profile;
+    double statstart; // when the running block began
+    double statperiod; // seconds of signal in a block
+    double stattotal;
+    double statmax;
+    long statblocks;
+    long stathist[STATBUCKETS];
+
+    /* the helper threads, out of the way of the fields every block reads */
+    t_ring64worker workers[MAXTHREADS];
 } t_ring64;
 
+static void ring64_setisa(t_ring64 *x);
+static int ring64_cpuisa(void);
+
 
 
 static t_class *ring64_class;
 
 
 
-static void *ring64_new( void)
+/* (re)allocate the per-band arena for nbands bands, keeping the contents of
+   the previous one. New bands start with frequency multiplier 1 and gain 0.
+   The slot arrays the band kernels read every sample come first and side
+   by side, then those read once a block or while interpolating, then the
+   band parameters and the scratch of ring64_activate. */
+static int ring64_alloc(t_ring64 *x, int nbands)
+{
+    FLOAT **darrays[] = {&x->x_bp, &x->s1, &x->s2, &x->coef_g, &x->coef_d,
+        &x->coef_b, &x->gainband, &x->gainstep, &x->slotmult,
+        &x->coef_ginc, &x->coef_dinc, &x->coef_binc,
+        &x->p_gainband, &x->gainbandold, &x->gainbandincrement,
+        &x->gainbandleft, &x->gainbandcoef, &x->freqmult,
+        &x->old_s1, &x->old_s2, &x->old_bp};
+    int **iarrays[] = {&x->active, &x->old_slot};
+    int nd = sizeof(darrays) / sizeof(*darrays), ni = sizeof(iarrays) / sizeof(*iarrays);
+    size_t dsize = (nbands * sizeof(FLOAT) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+    size_t isize = (nbands * sizeof(int) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+    size_t size = nd * dsize + ni * isize + CACHELINE;
+    int keep = (x->maxbands < nbands ? x->maxbands : nbands), i, m;
+    char *arena = (char *)getbytes(size), *p;
+    if (!arena)
+        return (0);
+    p = (char *)(((size_t)arena + CACHELINE - 1) & ~(size_t)(CACHELINE - 1));
+    for (i = 0; i < nd; i++, p += dsize)
+    {
+        if (x->arena)
+            memcpy(p, *darrays[i], keep * sizeof(FLOAT));
+        *darrays[i] = (FLOAT *)p;
+    }
+    for (i = 0; i < ni; i++, p += isize)
+    {
+        if (x->arena)
+            memcpy(p, *iarrays[i], keep * sizeof(int));
+        *iarrays[i] = (int *)p;
+    }
+    for (m = keep; m < nbands; ++m)
+        x->freqmult[m] = 1;
+    if (x->arena)
+        freebytes(x->arena, x->arenasize);
+    x->arena = arena;
+    x->arenasize = size;
+    x->maxbands = nbands;
+    return (1);
+}
+
+/* (re)allocate the slot arrays of nchans voices for maxbands bands each,
+   keeping the voices that stay as they are. With nchans 1 the voices are
+   freed and the single voice takes over again. Called from the dsp and
+   bands methods only; on failure the previous voices are left in place. */
+static int ring64_allocvoices(t_ring64 *x, int nchans)
+{
+    size_t dsize = (x->maxbands * sizeof(FLOAT) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+    size_t isize = (x->maxbands * sizeof(int) + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+    size_t size = nchans * (9 * dsize + isize) + CACHELINE;
+    int keepchans = (x->voices ? (x->nchans < nchans ? x->nchans : nchans) : 0);
+    int keep = (x->voicebands < x->maxbands ? x->voicebands : x->maxbands), c, i;
+    t_ring64voice *voices = 0;
+    char *arena = 0, *p;
+    if (nchans > 1)
+    {
+        arena = (char *)getbytes(size);
+        voices = (t_ring64voice *)getbytes(nchans * sizeof(t_ring64voice));
+        if (!arena || !voices)
+        {
+            if (arena)
+                freebytes(arena, size);
+            if (voices)
+                freebytes(voices, nchans * sizeof(t_ring64voice));
+            return (0);
+        }
+        p = (char *)(((size_t)arena + CACHELINE - 1) & ~(size_t)(CACHELINE - 1));
+        for (c = 0; c < nchans; c++)
+        {
+            t_ring64voice *v = &voices[c];
+            FLOAT **darrays[] = {&v->v_bp, &v->v_s1, &v->v_s2, &v->v_coefg,
+                &v->v_coefd, &v->v_coefb, &v->v_gainband, &v->v_gainstep,
+                &v->v_slotmult};
+            if (c < keepchans)
+                *v = x->voices[c];
+            else
+            {
+                v->v_nactive = 0;
+                v->v_dirty = 1;
+                v->v_asleep = 0;
+                v->v_activecutoff = v->v_activebrightness = 0;
+                v->v_cutoffold = 0;
+                v->v_resonanceold = 1;
+                v->v_brightnessold = 0;
+                v->v_antidenormal = 1e-20;
+                v->v_coefvalid = 0;
+                v->v_coefcutoff = v->v_coefresonance = 0;
+            }
+            for (i = 0; i < 9; i++, p += dsize)
+            {
+                if (c < keepchans)
+                    memcpy(p, *darrays[i], keep * sizeof(FLOAT));
+                *darrays[i] = (FLOAT *)p;
+            }
+            if (c < keepchans)
+                memcpy(p, v->v_active, keep * sizeof(int));
+            v->v_active = (int *)p;
+            p += isize;
+        }
+    }
+    if (x->voices)
+    {
+        freebytes(x->voicearena, x->voicearenasize);
+        freebytes(x->voices, x->nchans * sizeof(t_ring64voice));
+    }
+    x->dirty = 1; // the voices propagate and clear it, see ring64_perform_voices
+    x->voices = voices;
+    x->voicearena = arena;
+    x->voicearenasize = size;
+    x->voicebands = x->maxbands;
+    x->nchans = (nchans > 1 ? nchans : 1);
+    return (1);
+}
+
+static void *ring64_new(t_floatarg f)
 {
     t_ring64 *x = (t_ring64 *)pd_new(ring64_class);
+    int nbands = f;
+    if (nbands > MAXBANDS)
+        nbands = MAXBANDS;
+    x->arena = 0;
+    x->maxbands = 0;
+    x->nchans = x->cutchans = x->reschans = x->brightchans = 1;
+    x->voices = 0;
+    x->voicearena = 0;
+    x->voicebands = 0;
+    /* everything ring64_free looks at is set up before the first
+       allocation, which may fail and free the object right away */
+    x->nworkers = 0;
+    x->sumsraw = 0;
+    x->blocksize = 0;
+    x->ticket = x->partsdone = x->quit = 0;
+#ifdef RING64_THREADS
+    pthread_mutex_init(&x->parklock, 0);
+    pthread_cond_init(&x->parkcond, 0);
+    x->parked = 0;
+#endif
+    if (!ring64_alloc(x, nbands > BANDS ? nbands : BANDS))
+    {
+        pd_error(x, "ring64~: out of memory");
+        pd_free((t_pd *)x);
+        return (0);
+    }
     x->x_out = outlet_new(&x->x_obj, gensym("signal"));
     inlet_new(&x->x_obj, &x->x_obj.ob_pd, &s_signal, &s_signal);
     inlet_new(&x->x_obj, &x->x_obj.ob_pd, &s_signal, &s_signal);
@@ -68,28 +486,68 @@ static void *ring64_new( void)
     x->PI = 4.0f * atanf(1.0f);
 
     /* default values */
-    int m;
-    for (m = 0; m < BANDS; ++m) // init all 64 filters
-    {
-        x->s1[m] = 0;
-        x->s2[m] = 0;
-        x->freqmult[m] = 1;
-        x->gainband[m] = 1;
-    }
-    x->numberbands = 16;
+    x->numberbands = (nbands >= 1 ? nbands : 16);
+    x->nactive = 0;
+    x->dirty = 1;
     x->p_cutoff = x->cutoffold = 0.0f;
     x->p_resonance = x->resonanceold = 1.0f;
     x->p_brightness = x->brightnessold = 0;
     x->softclip = 0;
     x->gain = 0.9;
+    x->coeffrate = 0;
+    x->coefvalid = 0;
+    x->coefcutoff = x->coefresonance = 0;
+    x->paramrate = PARAM_BLOCK;
+    x->ramptime = 0;
+    x->rampcurve = CURVE_LINEAR;
+    x->gliding = x->glidelen = 0;
+    x->engine = ENGINE_ZDF;
+    x->isamax = NISA - 1;
+    ring64_setisa(x);
+    x->sleepthresh = 0;
+    x->asleep = 0;
+    x->sleepcount = x->sleepblocks = x->totalblocks = 0;
+    x->denormal = DENORMAL_OFF;
+    x->antidenormal = 1e-20;
+    x->denormals = 0;
+    x->freqarray = x->gainarray = 0;
+    x->freqvec = x->gainvec = 0;
+    x->nthreads = 1;
+    x->profile = 0;
+    x->statperiod = 0;
     return (x);
 }
 
+static void ring64_stopworkers(t_ring64 *x);
+
+static void ring64_free(t_ring64 *x)
+{
+    ring64_stopworkers(x);
+    if (x->sumsraw)
+        freebytes(x->sumsraw, x->sumssize);
+    if (x->arena)
+        freebytes(x->arena, x->arenasize);
+    ring64_allocvoices(x, 1);
+#ifdef RING64_THREADS
+    pthread_cond_destroy(&x->parkcond);
+    pthread_mutex_destroy(&x->parklock);
+#endif
+}
+
+
+static FLOAT ring64_clipgain(FLOAT gain)
+{
+    if (gain > 16.0f)
+        return (16.0f);
+    else if (gain < 0.0f)
+        return (0.0f);
+    else return (gain);
+}
 
 void ring64_freqs(t_ring64 *x, t_symbol *selector, int argcount, t_atom *argvec)
 {
     int i;
-    for (i = 0; i < argcount; i++)
+    for (i = 0; i < argcount && i < x->maxbands; i++)
     {
     	if (argvec[i].a_type == A_FLOAT)
       {
@@ -98,37 +556,167 @@ void ring64_freqs(t_ring64 *x, t_symbol *selector, int argcount, t_atom *argvec)
     	else if (argvec[i].a_type == A_SYMBOL)
 	    error("Wrong argument type: %s", argvec[i].a_w.w_symbol->s_name);
     }
+    x->dirty = 1;
+}
+
+/* set band k to gain, at once or in a ramp of ms. Ramps go from wherever
+   the band is, so a new target takes over a ramp in progress. A jump
+   rebuilds the bands; a ramp only when the band comes in from muted. */
+static void ring64_setgain(t_ring64 *x, int k, FLOAT gain, FLOAT ms)
+{
+    FLOAT samples = ms * 0.001f * x->x_sr;
+    x->p_gainband[k] = gain;
+    if (samples < 1) // also before the first dsp, when there is no rate yet
+    {
+        x->gainbandold[k] = gain;
+        x->gainbandincrement[k] = x->gainbandleft[k] = 0;
+        x->dirty = 1;
+        return;
+    }
+    x->gainbandleft[k] = samples;
+    x->gainbandcoef[k] = (x->rampcurve == CURVE_EXP ? exp(-6.91 / samples) : 0);
+    if (x->gainbandold[k] <= 0)
+        x->dirty = 1;
+    x->gliding = 1;
 }
 
 void ring64_gains(t_ring64 *x, t_symbol *selector, int argcount, t_atom *argvec)
 {
     int i;
-    for (i = 0; i < argcount; i++)
+    for (i = 0; i < argcount && i < x->maxbands; i++)
     {
     	if (argvec[i].a_type == A_FLOAT)
-      {
-        if(argvec[i].a_w.w_float > 16.0f )
-             x->p_gainband[i] = argvec[i].a_w.w_float  = 16.0f;
-        else if(argvec[i].a_w.w_float < 0.0f)
-             x->p_gainband[i] = argvec[i].a_w.w_float  = 0.0f;
-        else x->p_gainband[i]= argvec[i].a_w.w_float;
-      }
+            ring64_setgain(x, i, ring64_clipgain(argvec[i].a_w.w_float),
+                x->ramptime);
     	else if (argvec[i].a_type == A_SYMBOL)
 	    error("Wrong argument type: %s", argvec[i].a_w.w_symbol->s_name);
     }
 }
 
+/* ramp <ms>: time the band gains take to reach new values, 0 (default) to
+   jump. curve lin|exp: straight ramps, or a glide that slows down as it
+   closes in, for ramps started from then on */
+void ring64_ramp(t_ring64 *x, t_float ms)
+{
+    x->ramptime = (ms > 0 ? ms : 0);
+}
+
+void ring64_curve(t_ring64 *x, t_symbol *s)
+{
+    if (s == gensym("lin"))
+        x->rampcurve = CURVE_LINEAR;
+    else if (s == gensym("exp"))
+        x->rampcurve = CURVE_EXP;
+    else pd_error(x, "ring64~: unknown curve '%s' (lin, exp)", s->s_name);
+}
+
+/* freq <band> <mult>: change one band, counting from 0 */
+void ring64_freq(t_ring64 *x, t_float band, t_float mult)
+{
+    int i = band;
+    if (i < 0 || i >= x->maxbands)
+    {
+        pd_error(x, "ring64~: band %d out of range", i);
+        return;
+    }
+    x->freqmult[i] = mult;
+    x->dirty = 1;
+}
+
+/* look up a garray for setfreqs/setgains, 0 if there is none */
+static t_word *ring64_findarray(t_ring64 *x, t_symbol *s, int *size)
+{
+    t_garray *a;
+    t_word *vec;
+    if (!s)
+        return (0);
+    if (!(a = (t_garray *)pd_findbyclass(s, garray_class)))
+    {
+        pd_error(x, "ring64~: %s: no such array", s->s_name);
+        return (0);
+    }
+    if (!garray_getfloatwords(a, size, &vec))
+    {
+        pd_error(x, "ring64~: %s: bad template", s->s_name);
+        return (0);
+    }
+    garray_usedindsp(a);
+    return (vec);
+}
+
+/* setfreqs <array> / setgains <array>: take the band table from a garray
+   instead of freqs/gains lists. The perform routine compares the table with
+   the current values each block and only rebuilds the bands when it has been
+   redrawn. Without an argument the binding is dropped. */
+void ring64_setfreqs(t_ring64 *x, t_symbol *s)
+{
+    x->freqarray = (*s->s_name ? s : 0);
+    x->freqvec = ring64_findarray(x, x->freqarray, &x->freqvecsize);
+}
+
+void ring64_setgains(t_ring64 *x, t_symbol *s)
+{
+    x->gainarray = (*s->s_name ? s : 0);
+    x->gainvec = ring64_findarray(x, x->gainarray, &x->gainvecsize);
+}
+
+/* copy a redrawn freqs/gains table, returns nonzero if the freqs changed */
+static int ring64_readarrays(t_ring64 *x)
+{
+    int i, n, changed = 0;
+    if (x->freqvec)
+    {
+        n = (x->freqvecsize < x->numberbands ? x->freqvecsize : x->numberbands);
+        for (i = 0; i < n; i++)
+            if (x->freqmult[i] != x->freqvec[i].w_float)
+                x->freqmult[i] = x->freqvec[i].w_float, changed = 1;
+    }
+    if (x->gainvec) // ring64_setgain marks the bands dirty itself
+    {
+        n = (x->gainvecsize < x->numberbands ? x->gainvecsize : x->numberbands);
+        for (i = 0; i < n; i++)
+        {
+            FLOAT gain = ring64_clipgain(x->gainvec[i].w_float);
+            if (x->p_gainband[i] != gain)
+                ring64_setgain(x, i, gain, x->ramptime);
+        }
+    }
+    return (changed);
+}
+
 void ring64_bands(t_ring64 *x, t_float bands)
 {
   if(bands<1)
-      x->numberbands = 1;
-  else if (bands>64)
-      x->numberbands = 64;
-  else x->numberbands = bands;
+      bands = 1;
+  else if (bands>MAXBANDS)
+      bands = MAXBANDS;
+  if (bands > x->maxbands && (!ring64_alloc(x, bands)
+      || (x->voices && !ring64_allocvoices(x, x->nchans))))
+  {
+      pd_error(x, "ring64~: out of memory for %d bands", (int)bands);
+      return;
+  }
+  x->numberbands = bands;
+  x->dirty = 1;
 }
 
-void ring64_gain(t_ring64 *x, t_float gain)
+/* gain <g>: main gain, gain <band> <g> [ms]: gain of one band, counting
+   from 0, in a ramp of ms instead of the ramp time */
+void ring64_gain(t_ring64 *x, t_symbol *s, int argc, t_atom *argv)
 {
+    if (argc >= 2)
+    {
+        int i = atom_getfloatarg(0, argc, argv);
+        if (i < 0 || i >= x->maxbands)
+        {
+            pd_error(x, "ring64~: band %d out of range", i);
+            return;
+        }
+        ring64_setgain(x, i, ring64_clipgain(atom_getfloatarg(1, argc, argv)),
+            (argc >= 3 ? atom_getfloatarg(2, argc, argv) : x->ramptime));
+        return;
+    }
+    FLOAT gain = atom_getfloatarg(0, argc, argv);
     if (gain<0)
         x->gain = 0;
     else if (gain>2)
@@ -137,6 +725,82 @@ void ring64_gain(t_ring64 *x, t_float gain)
 }
 
 
+/* how often the prewarp coefficients are computed: 0 = once per block,
+   1 = exact at audio rate, N = every N samples with linear interpolation */
+void ring64_coeffrate(t_ring64 *x, t_float coeffrate)
+{
+    if (coeffrate < 0)
+        x->coeffrate = 0;
+    else x->coeffrate = coeffrate;
+}
+
+
+/* band filter: "zdf" (default) or "modal". The modal engine is a complex
+   one-pole resonator per band, with the same center frequency, decay and
+   peak gain as the ZDF bandpass but much cheaper to run. */
+void ring64_engine(t_ring64 *x, t_symbol *s)
+{
+    int engine, m, c;
+    if (s == gensym("zdf"))
+        engine = ENGINE_ZDF;
+    else if (s == gensym("modal"))
+        engine = ENGINE_MODAL;
+    else
+    {
+        pd_error(x, "ring64~: unknown engine '%s' (zdf, modal)", s->s_name);
+        return;
+    }
+    if (engine != x->engine)
+    {
+        for (m = 0; m < x->nactive; ++m) // the states mean different things
+            x->s1[m] = x->s2[m] = x->x_bp[m] = 0;
+        for (c = 0; x->voices && c < x->nchans; c++)
+            for (m = 0; m < x->voices[c].v_nactive; ++m)
+                x->voices[c].v_s1[m] = x->voices[c].v_s2[m] =
+                    x->voices[c].v_bp[m] = 0;
+        x->engine = engine;
+        x->dirty = 1; // and so do the coefficients
+    }
+}
+
+
+/* sleep <threshold>: band state level below which a silent bank stops
+   computing, 0 (default) to never sleep */
+void ring64_sleep(t_ring64 *x, t_float thresh)
+{
+    int c;
+    x->sleepthresh = (thresh > 0 ? thresh : 0);
+    x->asleep = 0;
+    for (c = 0; x->voices && c < x->nchans; c++)
+        x->voices[c].v_asleep = 0;
+}
+
+
+static const char *denormalnames[] = {"off", "ftz", "offset", "snap"};
+
+/* denormal <off|ftz|offset|snap>: how subnormal states are avoided */
+void ring64_denormal(t_ring64 *x, t_symbol *s)
+{
+    if (s == gensym("off"))
+        x->denormal = DENORMAL_OFF;
+    else if (s == gensym("ftz"))
+    {
+#ifdef HAVE_FTZ
+        x->denormal = DENORMAL_FTZ;
+#else
+        post("ring64~: no flush-to-zero on this CPU, using snap");
+        x->denormal = DENORMAL_SNAP;
+#endif
+    }
+    else if (s == gensym("offset"))
+        x->denormal = DENORMAL_OFFSET;
+    else if (s == gensym("snap"))
+        x->denormal = DENORMAL_SNAP;
+    else pd_error(x, "ring64~: unknown denormal mode '%s' (off, ftz, offset, snap)",
+        s->s_name);
+}
+
+
 void ring64_softclip(t_ring64 *x, t_float softclip)
 {
   x->softclip = softclip;
@@ -145,15 +809,772 @@ void ring64_softclip(t_ring64 *x, t_float softclip)
 
 static void ring64_print(t_ring64 *x)
 {
-    post("%d bands ", x->numberbands);
+    post("%d bands (%d active, room for %d)", x->numberbands, x->nactive,
+        (int)x->maxbands);
     if (x->softclip == 1)
     {
         post("soft clip ON");
     }
     else
         post("soft clip OFF");
+    if (x->coeffrate == 0)
+        post("coefficients: control rate (once per block)");
+    else if (x->coeffrate == 1)
+        post("coefficients: audio rate");
+    else
+        post("coefficients: every %d samples, interpolated", (int)x->coeffrate);
+    if (x->ramptime > 0)
+    {
+        int k, ramps = 0;
+        for (k = 0; k < x->maxbands; k++)
+            ramps += (x->gainbandleft[k] > 0);
+        post("gain ramps: %g ms, %s, %d bands ramping", x->ramptime,
+            (x->rampcurve == CURVE_EXP ? "exp" : "lin"), ramps);
+    }
+    else post("gain ramps: off");
+    post("engine: %s", (x->engine == ENGINE_MODAL ? "modal" : "zdf"));
+    post("channels: %d", x->nchans);
+    post("memory: %d bytes, %d of them for the bands", (int)(sizeof(t_ring64)
+        + x->arenasize + x->sumssize + (x->voices ? x->voicearenasize
+            + x->nchans * sizeof(t_ring64voice) : 0)),
+        (int)(x->arenasize + (x->voices ? x->voicearenasize : 0)));
+    post("threads: %d (%d ranges last block)", x->nthreads, x->nparts);
+    post("isa: %s (cpu: %s)", isanames[x->isa], isanames[ring64_cpuisa()]);
+    post("denormals: %s, %ld subnormal states seen",
+        denormalnames[x->denormal], x->denormals);
+    if (x->sleepthresh > 0)
+        post("sleep: below %g, %s, slept %ld of %ld blocks (%ld times)",
+            x->sleepthresh, (x->asleep ? "asleep" : "awake"),
+            x->sleepblocks, x->totalblocks, x->sleepcount);
+    else post("sleep: off");
+}
+
+
+/* the brightness tilt of band k, the weight of its gain */
+static FLOAT ring64_tilt(t_ring64 *x, int k)
+{
+    FLOAT pivot = 4; // completely empirical.... could maybe be user defined.. 
+    return (x->p_brightness*((k+1-pivot)/pivot)+ 1);
+}
+
+/* rebuild the brightness weighted band gains and the list of active bands.
+   Called only when cutoff, brightness, gains, freqs or the band count have
+   changed. Bands keep their filter state while they stay active; bands that
+   drop out are reset and restart from silence. A ramping band counts as
+   muted only when it both is and goes to zero. */
+static void ring64_activate(t_ring64 *x)
+{
+    FLOAT *s1 = x->old_s1, *s2 = x->old_s2, *bp = x->old_bp;
+    int *slot = x->old_slot, k, n = 0;
+
+    for (k = 0; k < x->maxbands; ++k)
+        slot[k] = -1;
+    for (k = 0; k < x->nactive; ++k)
+    {
+        slot[x->active[k]] = k;
+        s1[k] = x->s1[k];
+        s2[k] = x->s2[k];
+        bp[k] = x->x_bp[k];
+    }
+    for (k = 0; k < x->numberbands; ++k)
+    {
+        FLOAT gain;
+        if (x->p_cutoff * x->freqmult[k] > 0.48 * x->x_sr) // band limiting
+            continue;
+        if (x->p_gainband[k] <= 0 && x->gainbandold[k] <= 0) // muted
+            continue;
+        /* bands pushed below zero by the brightness tilt keep running so
+           that they fade back in with their resonance intact */
+        gain = x->gainbandold[k]*ring64_tilt(x, k);
+        if (gain < 0)
+            gain = 0;
+        x->active[n] = k;
+        x->gainband[n] = gain;
+        x->slotmult[n] = x->freqmult[k];
+        if (slot[k] >= 0)
+        {
+            x->s1[n] = s1[slot[k]];
+            x->s2[n] = s2[slot[k]];
+            x->x_bp[n] = bp[slot[k]];
+        }
+        else x->s1[n] = x->s2[n] = x->x_bp[n] = 0; // reset filter states
+        n++;
+    }
+    x->nactive = n;
+    x->activecutoff = x->p_cutoff;
+    x->activebrightness = x->p_brightness;
+    x->dirty = 0;
+    x->coefvalid = 0; // the slots hold other bands now
+}
+
+/* plan the gain ramps for a block of n samples: take in where the last
+   block has left each ramping band, then give it the per sample step to
+   where it is at the end of this one. An exponential ramp closes a fixed
+   part of the distance each sample and lands on its target when its time
+   is up. Once the last ramp is taken in the bands are rebuilt, which also
+   drops those that ramped to zero. */
+static void ring64_glide(t_ring64 *x, int n)
+{
+    int k, ramps = 0;
+    for (k = 0; k < x->maxbands; k++)
+    {
+        FLOAT left = x->gainbandleft[k], target = x->p_gainband[k], from, to;
+        if (x->gainbandincrement[k] != 0)
+        {
+            x->gainbandold[k] = (left > 0 ? x->gainbandold[k]
+                + x->gainbandincrement[k] * x->glidelen : target);
+            x->gainbandincrement[k] = 0;
+        }
+        if (left <= 0)
+            continue;
+        from = x->gainbandold[k];
+        if (left <= n)
+            to = target;
+        else if (x->gainbandcoef[k] > 0)
+            to = target + (from - target) * pow(x->gainbandcoef[k], n);
+        else to = from + (target - from) * n / left;
+        x->gainbandincrement[k] = (to - from) / n;
+        x->gainbandleft[k] = left - n;
+        ramps++;
+    }
+    x->glidelen = n;
+    if (!ramps)
+    {
+        x->gliding = 0;
+        x->dirty = 1;
+    }
+}
+
+/* while bands ramp: the gain of each slot at the start of the block and
+   its step per sample, from the plan of ring64_glide */
+static void ring64_glideslots(t_ring64 *x)
+{
+    int m, k;
+    for (m = 0; m < x->nactive; ++m)
+    {
+        FLOAT tilt = ring64_tilt(x, k = x->active[m]);
+        if (tilt > 0)
+        {
+            x->gainband[m] = x->gainbandold[k] * tilt;
+            x->gainstep[m] = x->gainbandincrement[k] * tilt;
+        }
+        else x->gainband[m] = x->gainstep[m] = 0;
+    }
+}
+
+/* coefficients for slots lo..hi-1 at the given cutoff and resonance.
+   ZDF: bilinear prewarp g and d = 1/(1 + 2Rg + g^2).
+   modal: pole r e^(jw) at the band frequency, with r = e^(-Rw) matching the
+   decay of the bandpass and b = (1-r)/R matching its peak gain 1/(2R). */
+static void ring64_coeffs(t_ring64 *x, FLOAT cutoff, FLOAT resonance,
+    FLOAT *g, FLOAT *d, FLOAT *b, int lo, int hi)
+{
+    int m;
+    if (x->engine == ENGINE_MODAL)
+    {
+        for (m = lo; m < hi; ++m)
+        {
+            FLOAT wd = 2*x->PI*cutoff*x->slotmult[m]*x->T;
+            FLOAT r = exp(-resonance * wd);
+            g[m] = r * cos(wd);
+            d[m] = r * sin(wd);
+            b[m] = (1. - r) / resonance;
+        }
+        return;
+    }
+    for (m = lo; m < hi; ++m)
+    {
+        FLOAT wd = 2*x->PI*cutoff*x->slotmult[m];
+        FLOAT wa = (2.0f * x->x_sr) * tan(wd * x->T * 0.5f);
+        g[m] = wa * x->T * 0.5f;
+        d[m] = 1. / (1. + 2. * resonance * g[m] + g[m] * g[m]);
+    }
+}
+
+/* the vector loops of both engines for the register type t_v, see
+   ring64_kernel and ring64_modalkernel. Each runs from slot m while a
+   whole vector fits below hi, adds its band sum to *sum and returns the
+   slot it stopped at. The lanes are summed by halving the vector. */
+#define RING64_VECTORS(t_v) \
+FORCEINLINE FLOAT ring64_lanesum_##t_v(t_v *v) \
+{ \
+    int w, l; \
+    for (w = sizeof(t_v) / sizeof(FLOAT) / 2; w > 0; w /= 2) \
+        for (l = 0; l < w; l++) \
+            (*v)[l] += (*v)[l + w]; \
+    return ((*v)[0]); \
+} \
+\
+FORCEINLINE int ring64_zdf_##t_v(t_ring64 *x, FLOAT input, FLOAT r2, \
+    int m, int hi, FLOAT *sum) \
+{ \
+    FLOAT *s1 = x->s1, *s2 = x->s2, *bp = x->x_bp; \
+    FLOAT *g = x->coef_g, *d = x->coef_d, *gain = x->gainband; \
+    int n = sizeof(t_v) / sizeof(FLOAT); \
+    t_v vsum = {0}; \
+    for (; m + n <= hi; m += n) \
+    { \
+        t_v vg = *(t_v *)(g + m); \
+        t_v vs1 = *(t_v *)(s1 + m); \
+        t_v vs2 = *(t_v *)(s2 + m); \
+        t_v hp = (input - r2 * vs1 - vg * vs1 - vs2) * *(t_v *)(d + m); \
+        t_v vbp = vg * hp + vs1; \
+        t_v lp = vg * vbp + vs2; \
+        *(t_v *)(s1 + m) = vg * hp + vbp; \
+        *(t_v *)(s2 + m) = vg * vbp + lp; \
+        *(t_v *)(bp + m) = vbp; \
+        vsum += vbp * *(t_v *)(gain + m); \
+    } \
+    *sum += ring64_lanesum_##t_v(&vsum); \
+    return (m); \
+} \
+\
+FORCEINLINE int ring64_modal_##t_v(t_ring64 *x, FLOAT input, int m, \
+    int hi, FLOAT *sum) \
+{ \
+    FLOAT *re = x->s1, *im = x->s2; \
+    FLOAT *c = x->coef_g, *sn = x->coef_d, *b = x->coef_b; \
+    FLOAT *gain = x->gainband; \
+    int n = sizeof(t_v) / sizeof(FLOAT); \
+    t_v vsum = {0}; \
+    for (; m + n <= hi; m += n) \
+    { \
+        t_v vre = *(t_v *)(re + m), vim = *(t_v *)(im + m); \
+        t_v vc = *(t_v *)(c + m), vs = *(t_v *)(sn + m); \
+        t_v nre = vc * vre - vs * vim + *(t_v *)(b + m) * input; \
+        *(t_v *)(im + m) = vs * vre + vc * vim; \
+        *(t_v *)(re + m) = nre; \
+        vsum += nre * *(t_v *)(gain + m); \
+    } \
+    *sum += ring64_lanesum_##t_v(&vsum); \
+    return (m); \
+}
+#ifdef HAVE_VECTORS
+RING64_VECTORS(t_v128)
+#endif
+#ifdef HAVE_DISPATCH
+RING64_VECTORS(t_v256)
+RING64_VECTORS(t_v512)
+#endif
+
+/* one sample of the 2-pole ZDF bandpass for slots lo..hi-1, returns the
+   gain weighted sum of the bandpass outputs. The slot arrays start on a cache
+   line and lo is a multiple of the longest vector, so the vector loops use
+   aligned loads and stores.
+   The vector loop computes the same expressions in the same order as the
+   scalar loop; only the final sum is reassociated across lanes, and the
+   division is done once per band by coef_d. Against the former per-band
+   scalar code the output differs by a few ulps of the double accumulator,
+   i.e. well below the resolution of the 32 bit signal output.
+   isa is a constant in every caller, see RING64_RENDER. */
+FORCEINLINE FLOAT ring64_kernel(t_ring64 *x, FLOAT input, FLOAT resonance,
+    int lo, int hi, int isa)
+{
+    FLOAT *s1 = x->s1, *s2 = x->s2, *bp = x->x_bp;
+    FLOAT *g = x->coef_g, *d = x->coef_d, *gain = x->gainband;
+    FLOAT r2 = 2. * resonance;
+    FLOAT sum = 0;
+    int m = lo;
+
+#ifdef HAVE_DISPATCH
+    if (isa >= ISA_AVX512)
+        m = ring64_zdf_t_v512(x, input, r2, m, hi, &sum);
+    if (isa >= ISA_AVX2)
+        m = ring64_zdf_t_v256(x, input, r2, m, hi, &sum);
+#endif
+#ifdef HAVE_VECTORS
+    if (isa != ISA_SCALAR)
+        m = ring64_zdf_t_v128(x, input, r2, m, hi, &sum);
+#endif
+
+    /* scalar path: remaining bands, or all of them without SIMD */
+    for (; m < hi; m++)
+    {
+        FLOAT hp = (input - r2 * s1[m] - g[m] * s1[m] - s2[m]) * d[m];
+        FLOAT b = g[m] * hp + s1[m];
+        FLOAT lp = g[m] * b + s2[m];
+        s1[m] = g[m] * hp + b; // state update in 1st integrator
+        s2[m] = g[m] * b + lp; // state update in 2nd integrator
+        bp[m] = b;
+        sum += b * gain[m];
+    }
+    return (sum);
+}
+
+/* one sample of the modal engine for slots lo..hi-1: each resonator is
+   z = (c + js) z + b input, heard through Re(z). The input gain sits before
+   the resonator so that a ringing band keeps its level when the cutoff
+   moves, like the ZDF bandpass does. Returns the gain weighted sum. */
+FORCEINLINE FLOAT ring64_modalkernel(t_ring64 *x, FLOAT input, int lo,
+    int hi, int isa)
+{
+    FLOAT *re = x->s1, *im = x->s2;
+    FLOAT *c = x->coef_g, *sn = x->coef_d, *b = x->coef_b, *gain = x->gainband;
+    FLOAT sum = 0;
+    int m = lo;
+
+#ifdef HAVE_DISPATCH
+    if (isa >= ISA_AVX512)
+        m = ring64_modal_t_v512(x, input, m, hi, &sum);
+    if (isa >= ISA_AVX2)
+        m = ring64_modal_t_v256(x, input, m, hi, &sum);
+#endif
+#ifdef HAVE_VECTORS
+    if (isa != ISA_SCALAR)
+        m = ring64_modal_t_v128(x, input, m, hi, &sum);
+#endif
+
+    for (; m < hi; m++)
+    {
+        FLOAT r = c[m] * re[m] - sn[m] * im[m] + b[m] * input;
+        im[m] = sn[m] * re[m] + c[m] * im[m];
+        re[m] = r;
+        sum += r * gain[m];
+    }
+    return (sum);
+}
+
+/* run slots lo..hi-1 over a block of n samples and write the band sum of
+   each sample to sum[]. Touches nothing outside its range of slots, so
+   disjoint ranges can run on different threads. */
+FORCEINLINE void ring64_renderisa(t_ring64 *x, int lo, int hi, t_float *in,
+    FLOAT *sum, int n, int isa)
+{
+    FLOAT *cut = x->paramcut, *res = x->paramres;
+    int i, m, modal = (x->engine == ENGINE_MODAL);
+    if (x->paramrate == PARAM_BLOCK)
+    {
+        if (x->recoef)
+            ring64_coeffs(x, x->p_cutoff, x->p_resonance, x->coef_g,
+                x->coef_d, x->coef_b, lo, hi);
+        if (!x->gliding)
+        {
+            if (modal)
+                for (i = 0; i < n; i++)
+                    sum[i] = ring64_modalkernel(x, in[i], lo, hi, isa);
+            else for (i = 0; i < n; i++)
+                sum[i] = ring64_kernel(x, in[i], x->p_resonance, lo, hi, isa);
+            return;
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        /* coefficients: exact at the start of the block (and every sample at
+           audio rate), otherwise interpolated towards the exact values at
+           the end of each coeffrate segment */
+        if (x->paramrate == PARAM_AUDIO
+            || (i == 0 && x->paramrate == PARAM_INTERP))
+                ring64_coeffs(x, cut[i], res[i], x->coef_g, x->coef_d,
+                    x->coef_b, lo, hi);
+        if (x->paramrate == PARAM_INTERP && i % x->coeffrate == 0)
+        {
+            int len = (n - i < x->coeffrate ? n - i : x->coeffrate);
+            int end = (i + len < n ? i + len : n - 1);
+            ring64_coeffs(x, cut[end], res[end],
+                x->coef_ginc, x->coef_dinc, x->coef_binc, lo, hi);
+            for (m = lo; m < hi; ++m)
+            {
+                x->coef_ginc[m] = (x->coef_ginc[m] - x->coef_g[m]) / len;
+                x->coef_dinc[m] = (x->coef_dinc[m] - x->coef_d[m]) / len;
+            }
+            if (modal)
+                for (m = lo; m < hi; ++m)
+                    x->coef_binc[m] = (x->coef_binc[m] - x->coef_b[m]) / len;
+        }
+        if (modal)
+            sum[i] = ring64_modalkernel(x, in[i], lo, hi, isa);
+        else sum[i] = ring64_kernel(x, in[i], (x->paramrate == PARAM_BLOCK ?
+            x->p_resonance : res[i]), lo, hi, isa);
+        if (x->paramrate == PARAM_INTERP)
+        {
+            for (m = lo; m < hi; ++m)
+            {
+                x->coef_g[m] += x->coef_ginc[m];
+                x->coef_d[m] += x->coef_dinc[m];
+            }
+            if (modal)
+                for (m = lo; m < hi; ++m)
+                    x->coef_b[m] += x->coef_binc[m];
+        }
+        if (x->gliding) // sample by sample gain ramps
+            for (m = lo; m < hi; ++m)
+                x->gainband[m] += x->gainstep[m];
+    }
+}
+
+#define RING64_RENDER(isa, name, target) \
+static target void ring64_render_##name(t_ring64 *x, int lo, int hi, \
+    t_float *in, FLOAT *sum, int n) \
+{ \
+    ring64_renderisa(x, lo, hi, in, sum, n, isa); \
+}
+RING64_RENDER(ISA_SCALAR, scalar, )
+#ifdef HAVE_DISPATCH
+RING64_RENDER(ISA_SSE2, sse2, __attribute__((target("sse2"))))
+RING64_RENDER(ISA_AVX2, avx2, __attribute__((target("avx2"))))
+RING64_RENDER(ISA_AVX512, avx512, __attribute__((target("avx512f"))))
+#elif defined(HAVE_VECTORS)
+RING64_RENDER(ISA_SSE2, vector, )
+#endif
+
+typedef void (*t_render)(t_ring64 *x, int lo, int hi, t_float *in,
+    FLOAT *sum, int n);
+
+static const t_render ring64_renders[NISA] = {ring64_render_scalar,
+#ifdef HAVE_DISPATCH
+    ring64_render_sse2, ring64_render_avx2, ring64_render_avx512
+#elif defined(HAVE_VECTORS)
+    ring64_render_vector
+#endif
+};
+
+/* the widest level the cpu and the os support */
+static int ring64_cpuisa(void)
+{
+#ifdef HAVE_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return (ISA_AVX512);
+    if (__builtin_cpu_supports("avx2"))
+        return (ISA_AVX2);
+    if (__builtin_cpu_supports("sse2"))
+        return (ISA_SSE2);
+    return (ISA_SCALAR);
+#else
+    return (NISA - 1);
+#endif
+}
+
+static void ring64_setisa(t_ring64 *x)
+{
+    int cpu = ring64_cpuisa();
+    x->isa = (x->isamax < cpu ? x->isamax : cpu);
+    x->render = ring64_renders[x->isa];
+}
+
+/* isa <name>: use no wider kernels than these, for comparing them. auto
+   (or any unknown name) lets the cpu decide */
+static void ring64_isa(t_ring64 *x, t_symbol *s)
+{
+    int i;
+    x->isamax = NISA - 1;
+    for (i = 0; i < NISA; i++)
+        if (s == gensym(isanames[i]))
+            x->isamax = i;
+    ring64_setisa(x);
+}
+
+#ifdef RING64_THREADS
+/* claim and render ranges of block generation gen until none are left */
+static void ring64_work(t_ring64 *x, unsigned int gen)
+{
+    unsigned int t = __atomic_load_n(&x->ticket, __ATOMIC_ACQUIRE);
+    while ((t >> 16) == gen && (t & 0xff) < ((t >> 8) & 0xff))
+    {
+        int part = t & 0xff;
+        if (!__atomic_compare_exchange_n(&x->ticket, &t, t + 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                continue; // t now holds the current ticket
+        (*x->render)(x, x->partlo[part], x->partlo[part + 1], x->blockin,
+            x->sums + part * x->sumstride, x->blocksize);
+        __atomic_fetch_add(&x->partsdone, 1, __ATOMIC_RELEASE);
+        t = __atomic_load_n(&x->ticket, __ATOMIC_ACQUIRE);
+    }
+}
+
+/* start a new block generation with nparts ranges, none claimed yet */
+static unsigned int ring64_publish(t_ring64 *x, int nparts)
+{
+    unsigned int gen = ((__atomic_load_n(&x->ticket, __ATOMIC_ACQUIRE) >> 16) + 1)
+        & 0xffff;
+    __atomic_store_n(&x->ticket, (gen << 16) | (nparts << 8), __ATOMIC_SEQ_CST);
+    /* the helpers only park after many idle blocks' worth of spinning, so
+       while the DSP runs this takes no lock */
+    if (__atomic_load_n(&x->parked, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&x->parklock);
+        pthread_cond_broadcast(&x->parkcond);
+        pthread_mutex_unlock(&x->parklock);
+    }
+    return (gen);
+}
+
+/* block an idle helper until a generation after seen is published.
+   parked goes up before the ticket is looked at again, and ring64_publish
+   stores the ticket before it looks at parked, so one of the two always
+   sees the other */
+static void ring64_park(t_ring64 *x, unsigned int seen)
+{
+    pthread_mutex_lock(&x->parklock);
+    __atomic_fetch_add(&x->parked, 1, __ATOMIC_SEQ_CST);
+    while ((__atomic_load_n(&x->ticket, __ATOMIC_SEQ_CST) >> 16) == seen)
+        pthread_cond_wait(&x->parkcond, &x->parklock);
+    __atomic_fetch_sub(&x->parked, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&x->parklock);
+}
+
+/* helper thread: spin briefly for the next block, then yield, then park
+   so that idle workers take no cpu while the DSP is off. Any range a
+   parked worker misses is taken by the audio thread itself. */
+static void *ring64_worker(void *arg)
+{
+    t_ring64 *x = ((t_ring64worker *)arg)->w_owner;
+    unsigned int seen = __atomic_load_n(&x->ticket, __ATOMIC_ACQUIRE) >> 16;
+    int idle = 0;
+    while (1)
+    {
+        unsigned int gen = __atomic_load_n(&x->ticket, __ATOMIC_ACQUIRE) >> 16;
+        if (gen == seen)
+        {
+            /* a thread that first runs after ring64_stopworkers has
+               published takes that generation for one already seen */
+            if (__atomic_load_n(&x->quit, __ATOMIC_ACQUIRE))
+                break;
+            if (++idle < 4000)
+                SPIN_PAUSE();
+            else if (idle < 40000)
+                sched_yield();
+            else ring64_park(x, seen);
+            continue;
+        }
+        seen = gen;
+        idle = 0;
+        if (__atomic_load_n(&x->quit, __ATOMIC_ACQUIRE))
+            break;
+#ifdef HAVE_FTZ
+        if (x->denormal == DENORMAL_FTZ)
+        {
+            unsigned int csr = _mm_getcsr();
+            _mm_setcsr(csr | FTZ_DAZ);
+            ring64_work(x, gen);
+            _mm_setcsr(csr);
+        }
+        else
+#endif
+        ring64_work(x, gen);
+    }
+    return (0);
+}
+#endif
+
+static void ring64_stopworkers(t_ring64 *x)
+{
+#ifdef RING64_THREADS
+    int i;
+    if (!x->nworkers)
+        return;
+    __atomic_store_n(&x->quit, 1, __ATOMIC_RELEASE);
+    ring64_publish(x, 0);
+    for (i = 0; i < x->nworkers; i++)
+        pthread_join(x->workers[i].w_thread, 0);
+    x->nworkers = 0;
+    x->quit = 0;
+#endif
+}
+
+/* one row of block sums per thread and the two rows of per sample
+   parameters, allocated here and at dsp time only */
+static void ring64_allocsums(t_ring64 *x)
+{
+    int stride = (x->blocksize + CACHELINE / sizeof(FLOAT) - 1)
+        & ~(int)(CACHELINE / sizeof(FLOAT) - 1);
+    size_t size = (x->nthreads + 2) * stride * sizeof(FLOAT) + CACHELINE;
+    if (x->sumsraw)
+        freebytes(x->sumsraw, x->sumssize);
+    x->sumsraw = (char *)getbytes(size);
+    x->sumssize = size;
+    x->sums = (FLOAT *)(((size_t)x->sumsraw + CACHELINE - 1)
+        & ~(size_t)(CACHELINE - 1));
+    x->sumstride = stride;
+    x->paramcut = x->sums + x->nthreads * stride;
+    x->paramres = x->paramcut + stride;
+}
+
+/* number of threads that share the band loop, 1 (default) for none.
+   Output is reproducible for a given setting: every range always covers
+   the same bands and the range sums are added in the same order. */
+void ring64_threads(t_ring64 *x, t_float f)
+{
+    int n = f, i;
+    if (n < 1)
+        n = 1;
+    else if (n > MAXTHREADS)
+        n = MAXTHREADS;
+#ifndef RING64_THREADS
+    if (n > 1)
+        post("ring64~: compiled without thread support");
+    n = 1;
+#endif
+    ring64_stopworkers(x);
+    x->nthreads = n;
+#ifdef RING64_THREADS
+    for (i = 0; i < n - 1; i++)
+    {
+        x->workers[i].w_owner = x;
+        if (pthread_create(&x->workers[i].w_thread, 0, ring64_worker,
+            &x->workers[i]))
+        {
+            pd_error(x, "ring64~: could not start worker thread");
+            break;
+        }
+        x->nworkers++;
+    }
+#endif
+    if (x->blocksize)
+        ring64_allocsums(x);
 }
 
+/* seconds on a monotonic clock, for profile */
+static double ring64_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return ((double)count.QuadPart / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+#endif
+}
+
+/* the two ends of a timed block, added around the perform routine */
+static t_int *ring64_statbegin(t_int *w)
+{
+    t_ring64 *x = (t_ring64 *)(w[1]);
+    x->statstart = ring64_now();
+    return (w+2);
+}
+
+static t_int *ring64_statend(t_int *w)
+{
+    t_ring64 *x = (t_ring64 *)(w[1]);
+    double t = ring64_now() - x->statstart, us = t * 1e6;
+    int b = 0;
+    x->statblocks++;
+    x->stattotal += t;
+    if (t > x->statmax)
+        x->statmax = t;
+    for (; us >= 1 && b < STATBUCKETS - 1; us *= 0.5)
+        b++;
+    x->stathist[b]++;
+    return (w+2);
+}
+
+/* profile <0|1>: time every block of this object for stats. the timing
+   routines only go into the DSP chain while this is on, so off it costs
+   nothing. turning it on starts the counts afresh. with threads the
+   time is that of the whole bank, the workers run within it */
+static void ring64_profile(t_ring64 *x, t_float f)
+{
+    int i;
+    if (f != 0)
+    {
+        x->statblocks = 0;
+        x->stattotal = x->statmax = 0;
+        for (i = 0; i < STATBUCKETS; i++)
+            x->stathist[i] = 0;
+    }
+    if ((f != 0) == x->profile)
+        return;
+    x->profile = (f != 0);
+    canvas_update_dsp();
+}
+
+/* stats: post the block times counted since profile 1, as the mean and
+   the longest block, the share of real time they take and a histogram */
+static void ring64_stats(t_ring64 *x)
+{
+    int i;
+    if (!x->statblocks)
+    {
+        post("ring64~: no blocks timed%s", (x->profile ? "" :
+            ", profile is off"));
+        return;
+    }
+    post("ring64~: %ld blocks, mean %.2f us, max %.2f us, %.2f%% of real time",
+        x->statblocks, 1e6 * x->stattotal / x->statblocks, 1e6 * x->statmax,
+        (x->statperiod > 0 ? 100 * x->stattotal
+            / (x->statblocks * x->statperiod) : 0));
+    for (i = 0; i < STATBUCKETS - 1; i++)
+        if (x->stathist[i])
+            post("  under %d us: %ld", 1 << i, x->stathist[i]);
+    if (x->stathist[i])
+        post("  %d us and over: %ld", 1 << (i - 1), x->stathist[i]);
+}
+
+/* nonzero if the input block is all zeros */
+static int ring64_silent(t_float *in, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (in[i] != 0)
+            return (0);
+    return (1);
+}
+
+/* a signal that holds one value for the whole block, as a float sent to
+   a signal inlet does */
+static int ring64_constant(t_float *in, int n)
+{
+    int i;
+    for (i = 1; i < n; i++)
+        if (in[i] != in[0])
+            return (0);
+    return (1);
+}
+
+static FLOAT ring64_clipcutoff(t_ring64 *x, FLOAT cutoff)
+{
+    if (cutoff > x->x_sr*0.48f)
+        return (x->x_sr*0.48f);
+    if (cutoff < 0.0003f)
+        return (0.0003f);
+    return (cutoff);
+}
+
+/* decay time in ms to the damping of the bands, exponential (empirical) */
+static FLOAT ring64_damping(t_ring64 *x, FLOAT decay)
+{
+    FLOAT resonance = 1-exp((-1000.0f/ x->x_sr) / (6.91*decay));
+    if (resonance > 1)
+        return (1);
+    if (resonance < 0.00002f)
+        return (0.00002f);
+    return (resonance);
+}
+
+/* nonzero if every active band has decayed below the sleep threshold */
+static int ring64_decayed(t_ring64 *x)
+{
+    int m;
+    for (m = 0; m < x->nactive; m++)
+        if (fabs(x->s1[m]) >= x->sleepthresh || fabs(x->s2[m]) >= x->sleepthresh)
+            return (0);
+    return (1);
+}
+
+/* count subnormal band states and flush tiny ones in snap mode */
+static void ring64_denormals(t_ring64 *x)
+{
+    int m;
+    for (m = 0; m < x->nactive; m++)
+    {
+        if (x->s1[m] != 0 && fabs(x->s1[m]) < FLOAT_MIN)
+            x->denormals++;
+        if (x->s2[m] != 0 && fabs(x->s2[m]) < FLOAT_MIN)
+            x->denormals++;
+    }
+    if (x->denormal == DENORMAL_SNAP)
+        for (m = 0; m < x->nactive; m++)
+        {
+            if (fabs(x->s1[m]) < DENORMAL_TINY)
+                x->s1[m] = 0;
+            if (fabs(x->s2[m]) < DENORMAL_TINY)
+                x->s2[m] = 0;
+        }
+}
 
 static t_int *ring64_perform(t_int *w)
 {
@@ -165,6 +1586,46 @@ static t_int *ring64_perform(t_int *w)
     t_float *out = (t_float *)(w[6]);
     int n = (int)(w[7]), i, j;
     x->T = 1.0f / x->x_sr; // sampling period
+
+    /* the ramps go on while the bank sleeps. ring64_perform_voices plans
+       them once for all voices */
+    if (x->gliding && x->nchans == 1)
+        ring64_glide(x, n);
+
+    /* a parameter change (dirty) wakes the bank up */
+    x->totalblocks++;
+    if (x->sleepthresh > 0 && !x->dirty && ring64_silent(in1, n)
+        && (x->asleep || ring64_decayed(x)))
+    {
+        if (!x->asleep) // flush the decayed tails once
+        {
+            for (i = 0; i < x->nactive; i++)
+                x->s1[i] = x->s2[i] = x->x_bp[i] = 0;
+            x->asleep = 1;
+            x->sleepcount++;
+        }
+        x->sleepblocks++;
+        for (i = 0; i < n; i++)
+            out[i] = 0;
+        return (w+8);
+    }
+    x->asleep = 0;
+
+#ifdef HAVE_FTZ
+    unsigned int csr = _mm_getcsr();
+    if (x->denormal == DENORMAL_FTZ)
+        _mm_setcsr(csr | FTZ_DAZ);
+#endif
+    if (x->denormal == DENORMAL_OFFSET)
+    {
+        for (i = 0; i < x->nactive; i++)
+        {
+            x->s1[i] += x->antidenormal;
+            x->s2[i] += x->antidenormal;
+        }
+        x->antidenormal = -x->antidenormal;
+    }
+
     FLOAT oneoverblocksize = 1.0f/n;
     FLOAT oneovernumberbands = 1.0f/x->numberbands;
 
@@ -174,26 +1635,31 @@ static t_int *ring64_perform(t_int *w)
     //     else if (x->gain>2)
     //         x->gain = 2;
            
-    x->p_cutoff = *cutoffin++;
-    if(x->p_cutoff != x->cutoffold) // clip cutoff values
-    {
-       if(x->p_cutoff > x->x_sr*0.48f)
-            x->cutoffold = x->p_cutoff = x->x_sr*0.48f;
-        else if(x->p_cutoff < 0.0003f)
-            x->cutoffold = x->p_cutoff = 0.0003f;
-        else
-            x->cutoffold = x->p_cutoff;
-    }
-    
-    x->p_resonance = 1-exp((-1000.0f/ x->x_sr) / (6.91**resonancein++)); // exponential decay time (empirical)
-    if(x->p_resonance != x->resonanceold) // clip resonance values
+    x->p_cutoff = x->cutoffold = ring64_clipcutoff(x, *cutoffin);
+    x->p_resonance = x->resonanceold = ring64_damping(x, *resonancein);
+
+    /* coefficients follow the inlets within the block only at coeffrate
+       1 or N and only while an inlet moves; constant inlets and floats
+       take one set of coefficients per block */
+    x->paramrate = PARAM_BLOCK;
+    if (x->coeffrate > 0)
     {
-       if(x->p_resonance > 1)
-            x->resonanceold = x->p_resonance = 1;
-        else if(x->p_resonance < 0.00002f)
-            x->resonanceold = x->p_resonance = 0.00002f;
-        else
-            x->resonanceold = x->p_resonance;
+        int cutmoves = !ring64_constant(cutoffin, n);
+        int resmoves = !ring64_constant(resonancein, n);
+        if (cutmoves || resmoves)
+        {
+            x->paramrate = (x->coeffrate == 1 ? PARAM_AUDIO : PARAM_INTERP);
+            for (i = 0; i < n; i++)
+            {
+                x->paramcut[i] = (cutmoves ?
+                    ring64_clipcutoff(x, cutoffin[i]) : x->p_cutoff);
+                x->paramres[i] = (resmoves ?
+                    ring64_damping(x, resonancein[i]) : x->p_resonance);
+                /* band limit for the highest cutoff of the block */
+                if (x->paramcut[i] > x->p_cutoff)
+                    x->p_cutoff = x->paramcut[i];
+            }
+        }
     }
 
     x->p_brightness = *p_brightnessin++;
@@ -207,55 +1673,65 @@ static t_int *ring64_perform(t_int *w)
     }
 
  
-    x->cutoffincrement = (x->p_cutoff - x->cutoffold) * oneoverblocksize;
-    x->resonanceincrement = (x->p_resonance - x->resonanceold) * oneoverblocksize;
     x->brightnessincrement = (x->p_brightness - x->brightnessold) * oneoverblocksize;
-    FLOAT pivot = 4; // completely empirical.... could maybe be user defined.. 
 
+    if ((x->freqvec || x->gainvec) && ring64_readarrays(x))
+        x->dirty = 1;
+    if (x->dirty || x->p_cutoff != x->activecutoff
+        || x->p_brightness != x->activebrightness)
+            ring64_activate(x);
+    if (x->gliding)
+        ring64_glideslots(x);
+    x->recoef = !(x->coefvalid && x->coefcutoff == x->p_cutoff
+        && x->coefresonance == x->p_resonance);
+    x->coefvalid = (x->paramrate == PARAM_BLOCK);
+    x->coefcutoff = x->p_cutoff;
+    x->coefresonance = x->p_resonance;
 
-    for (i = 0; i < n; i++)
+    /* split the active slots into ranges of whole cache lines, at least
+       MINPART bands each, one per thread */
+#ifdef RING64_THREADS
+    int nparts = (x->nactive + MINPART - 1) / MINPART, p;
+    if (nparts > x->nworkers + 1)
+        nparts = x->nworkers + 1;
+    if (nparts < 1)
+        nparts = 1;
+#else
+    int nparts = 1, p;
+#endif
+    int chunk = ((x->nactive + nparts - 1) / nparts + CACHELINE / sizeof(FLOAT) - 1)
+        & ~(int)(CACHELINE / sizeof(FLOAT) - 1);
+    for (p = 0; p <= nparts; p++)
+        x->partlo[p] = (p * chunk < x->nactive ? p * chunk : x->nactive);
+    x->nparts = nparts;
+    x->blockin = in1;
+
+    if (nparts == 1)
+        (*x->render)(x, 0, x->nactive, in1, x->sums, n);
+#ifdef RING64_THREADS
+    else
     {
+        /* publish the block, then work alongside the helpers until every
+           range is done */
+        __atomic_store_n(&x->partsdone, 0, __ATOMIC_RELAXED);
+        ring64_work(x, ring64_publish(x, nparts));
+        while (__atomic_load_n(&x->partsdone, __ATOMIC_ACQUIRE) < nparts)
+            SPIN_PAUSE();
+    }
+#endif
+    ring64_denormals(x);
+#ifdef HAVE_FTZ
+    _mm_setcsr(csr);
+#endif
 
-        x->p_input = *in1++;
-        
-        int k;
-        for (k = 0; k < BANDS; ++k)
-        {
-            if (x->p_cutoff * x->freqmult[k] > 0.48 * x->x_sr) // band limiting
-            {
-                x->gainband[k] = 0; // mute band
-                x->s1[k] = 0; // reset filter states
-                x->s2[k] = 0;
-            }
-            else
-            {            
-            x->gainband[k] = x->p_gainband[k]*(x->p_brightness*((k+1-pivot)/pivot)+ 1);
-            }
+    for (i = 0; i < n; i++)
+    {
+        FLOAT sum = x->sums[i];
+        for (p = 1; p < nparts; p++)
+            sum += x->sums[p * x->sumstride + i];
+        x->sumout = sum * x->gain * oneovernumberbands;
 
-            if (x->gainband[k] < 0)
-                x->gainband[k] = 0;
-        }
 
-        int m;
-        for (m = 0; m < x->numberbands; ++m)
-        {
-            FLOAT wd = 2*x->PI*x->p_cutoff*x->freqmult[m];
-            FLOAT wa = (2.0f * x->x_sr) * tan(wd * x->T * 0.5f);
-            FLOAT g = wa * x->T * 0.5f;
-            x->x_hp[m] = (x->p_input - 2. * x->p_resonance * x->s1[m] - g * x->s1[m] - x->s2[m]) / (1. + 2. * x->p_resonance * g + g * g); 
-            x->x_bp[m] = g * x->x_hp[m] + x->s1[m]; 
-            x->s1[m] = g * x->x_hp[m] + x->x_bp[m]; // state update in 1st integrator 
-            x->x_lp[m] = g * x->x_bp[m] + x->s2[m]; 
-            x->s2[m] = g * x->x_bp[m] + x->x_lp[m]; // state update in 2nd integrator
-            x->singleout[m] = x->x_bp[m]*x->gainband[m];
-        }
-        int l;
-        x->sumout = 0;
-        for (l = 0; l < x->numberbands; ++l)
-          {
-            x->sumout = x->sumout + (x->gain*x->singleout[l] * oneovernumberbands);
-          }
-        
         //  soft-clipping if desired.
         if(x->softclip==1)
                 {
@@ -267,33 +1743,170 @@ static t_int *ring64_perform(t_int *w)
                     *out++ = (1.5f * x->sumout - 0.5f * x->sumout * x->sumout * x->sumout);
                 }
             else  *out++ = x->sumout;
+    }
+    return (w+8);
+}
+
+/* swap a voice in and out of the single voice fields */
+static void ring64_load(t_ring64 *x, t_ring64voice *v)
+{
+    x->x_bp = v->v_bp;
+    x->s1 = v->v_s1;
+    x->s2 = v->v_s2;
+    x->coef_g = v->v_coefg;
+    x->coef_d = v->v_coefd;
+    x->coef_b = v->v_coefb;
+    x->gainband = v->v_gainband;
+    x->gainstep = v->v_gainstep;
+    x->slotmult = v->v_slotmult;
+    x->active = v->v_active;
+    x->nactive = v->v_nactive;
+    x->dirty = v->v_dirty;
+    x->asleep = v->v_asleep;
+    x->activecutoff = v->v_activecutoff;
+    x->activebrightness = v->v_activebrightness;
+    x->cutoffold = v->v_cutoffold;
+    x->resonanceold = v->v_resonanceold;
+    x->brightnessold = v->v_brightnessold;
+    x->antidenormal = v->v_antidenormal;
+    x->coefvalid = v->v_coefvalid;
+    x->coefcutoff = v->v_coefcutoff;
+    x->coefresonance = v->v_coefresonance;
+}
 
-        x->p_cutoff += x->cutoffincrement;
-        x->p_resonance += x->resonanceincrement;
-        x->p_brightness += x->brightnessincrement;
+static void ring64_store(t_ring64 *x, t_ring64voice *v)
+{
+    v->v_bp = x->x_bp;
+    v->v_s1 = x->s1;
+    v->v_s2 = x->s2;
+    v->v_coefg = x->coef_g;
+    v->v_coefd = x->coef_d;
+    v->v_coefb = x->coef_b;
+    v->v_gainband = x->gainband;
+    v->v_gainstep = x->gainstep;
+    v->v_slotmult = x->slotmult;
+    v->v_active = x->active;
+    v->v_nactive = x->nactive;
+    v->v_dirty = x->dirty;
+    v->v_asleep = x->asleep;
+    v->v_activecutoff = x->activecutoff;
+    v->v_activebrightness = x->activebrightness;
+    v->v_cutoffold = x->cutoffold;
+    v->v_resonanceold = x->resonanceold;
+    v->v_brightnessold = x->brightnessold;
+    v->v_antidenormal = x->antidenormal;
+    v->v_coefvalid = x->coefvalid;
+    v->v_coefcutoff = x->coefcutoff;
+    v->v_coefresonance = x->coefresonance;
+}
+
+/* multichannel block: the voices take turns, each one swapped in and run
+   through ring64_perform on its own channels. The bands already fill the
+   lanes (and threads), so there is nothing to gain from running voices
+   side by side; messages and redrawn tables mark every voice dirty. */
+static t_int *ring64_perform_voices(t_int *w)
+{
+    t_ring64 *x = (t_ring64 *)(w[1]);
+    t_float *in1 = (t_float *)(w[2]);
+    t_float *cutoffin = (t_float *)(w[3]);
+    t_float *resonancein = (t_float *)(w[4]);
+    t_float *p_brightnessin = (t_float *)(w[5]);
+    t_float *out = (t_float *)(w[6]);
+    int n = (int)(w[7]), c;
+    t_int vw[8];
 
+    if ((x->freqvec || x->gainvec) && ring64_readarrays(x))
+        x->dirty = 1;
+    if (x->gliding)
+        ring64_glide(x, n);
+    for (c = 0; x->dirty && c < x->nchans; c++)
+        x->voices[c].v_dirty = 1;
+    x->dirty = 0;
+    ring64_store(x, &x->home);
+    vw[1] = (t_int)x;
+    vw[7] = n;
+    for (c = 0; c < x->nchans; c++)
+    {
+        ring64_load(x, &x->voices[c]);
+        vw[2] = (t_int)(in1 + c * n);
+        vw[3] = (t_int)(cutoffin + (c % x->cutchans) * n);
+        vw[4] = (t_int)(resonancein + (c % x->reschans) * n);
+        vw[5] = (t_int)(p_brightnessin + (c % x->brightchans) * n);
+        vw[6] = (t_int)(out + c * n);
+        ring64_perform(vw);
+        ring64_store(x, &x->voices[c]);
     }
+    ring64_load(x, &x->home);
     return (w+8);
 }
 
 static void ring64_dsp(t_ring64 *x, t_signal **sp)
 {
+    int nchans = 1;
     x->x_sr = sp[0]->s_sr;
-    dsp_add(ring64_perform, 7, x, sp[0]->s_vec, sp[1]->s_vec,
+    x->dirty = 1; // band limit and coefficients for this rate
+    ring64_setisa(x);
+    x->freqvec = ring64_findarray(x, x->freqarray, &x->freqvecsize);
+    x->gainvec = ring64_findarray(x, x->gainarray, &x->gainvecsize);
+    if (sp[0]->s_n != x->blocksize || !x->sumsraw)
+    {
+        x->blocksize = sp[0]->s_n;
+        ring64_allocsums(x);
+    }
+#ifdef CLASS_MULTICHANNEL
+    nchans = sp[0]->s_nchans;
+    x->cutchans = sp[1]->s_nchans;
+    x->reschans = sp[2]->s_nchans;
+    x->brightchans = sp[3]->s_nchans;
+    signal_setmultiout(&sp[4], nchans);
+#endif
+    if (nchans != x->nchans && !ring64_allocvoices(x, nchans))
+    {
+        pd_error(x, "ring64~: out of memory for %d channels", nchans);
+        dsp_add_zero(sp[4]->s_vec, nchans * sp[0]->s_n);
+        return;
+    }
+    x->statperiod = sp[0]->s_n / sp[0]->s_sr;
+    if (x->profile)
+        dsp_add(ring64_statbegin, 1, x);
+    dsp_add((x->nchans > 1 ? ring64_perform_voices : ring64_perform), 7,
+        x, sp[0]->s_vec, sp[1]->s_vec,
         sp[2]->s_vec, sp[3]->s_vec, sp[4]->s_vec, sp[0]->s_n);
+    if (x->profile)
+        dsp_add(ring64_statend, 1, x);
 }
 
 void ring64_tilde_setup(void)
 {
     int i;
+#ifdef CLASS_MULTICHANNEL
+    ring64_class = class_new(gensym("ring64~"),
+        (t_newmethod)ring64_new, (t_method)ring64_free, sizeof(t_ring64),
+        CLASS_MULTICHANNEL, A_DEFFLOAT, 0);
+#else
     ring64_class = class_new(gensym("ring64~"),
-        (t_newmethod)ring64_new, 0, sizeof(t_ring64), 0, 0);
+        (t_newmethod)ring64_new, (t_method)ring64_free, sizeof(t_ring64), 0,
+        A_DEFFLOAT, 0);
+#endif
     class_addmethod(ring64_class, (t_method)ring64_dsp, gensym("dsp"), A_CANT, 0);
     class_addmethod(ring64_class, (t_method)ring64_freqs, gensym("freqs"), A_GIMME, 0);
     class_addmethod(ring64_class, (t_method)ring64_gains, gensym("gains"), A_GIMME, 0);
     class_addmethod(ring64_class, (t_method)ring64_bands, gensym("bands"), A_FLOAT, 0);
     class_addmethod(ring64_class, (t_method)ring64_print, gensym("print"), 0);
     class_addmethod(ring64_class, (t_method)ring64_softclip, gensym("softclip"), A_FLOAT, 0);
-    class_addmethod(ring64_class, (t_method)ring64_gain, gensym("gain"), A_FLOAT, 0);
+    class_addmethod(ring64_class, (t_method)ring64_gain, gensym("gain"), A_GIMME, 0);
+    class_addmethod(ring64_class, (t_method)ring64_freq, gensym("freq"), A_FLOAT, A_FLOAT, 0);
+    class_addmethod(ring64_class, (t_method)ring64_setfreqs, gensym("setfreqs"), A_DEFSYM, 0);
+    class_addmethod(ring64_class, (t_method)ring64_setgains, gensym("setgains"), A_DEFSYM, 0);
+    class_addmethod(ring64_class, (t_method)ring64_coeffrate, gensym("coeffrate"), A_FLOAT, 0);
+    class_addmethod(ring64_class, (t_method)ring64_ramp, gensym("ramp"), A_FLOAT, 0);
+    class_addmethod(ring64_class, (t_method)ring64_curve, gensym("curve"), A_SYMBOL, 0);
+    class_addmethod(ring64_class, (t_method)ring64_threads, gensym("threads"), A_FLOAT, 0);
+    class_addmethod(ring64_class, (t_method)ring64_engine, gensym("engine"), A_SYMBOL, 0);
+    class_addmethod(ring64_class, (t_method)ring64_sleep, gensym("sleep"), A_FLOAT, 0);
+    class_addmethod(ring64_class, (t_method)ring64_denormal, gensym("denormal"), A_SYMBOL, 0);
+    class_addmethod(ring64_class, (t_method)ring64_isa, gensym("isa"), A_SYMBOL, 0);
+    class_addmethod(ring64_class, (t_method)ring64_profile, gensym("profile"), A_FLOAT, 0);
+    class_addmethod(ring64_class, (t_method)ring64_stats, gensym("stats"), 0);
     CLASS_MAINSIGNALIN(ring64_class, t_ring64, x_f);
 }
@@ -6,7 +6,39 @@
 
 #include "m_pd.h"
 #include <math.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+/* -DSINGLE_PRECISION runs the filter in float. The TPT integrators stay
+   well behaved down to the lowest cutoffs and the outputs match the double
+   build to the rounding of the float signal. The filter is scalar, so this
+   is for matching the other objects rather than for speed. Float states
+   decay into denormals much sooner though: run with sleep on, or with the
+   FPU flushing denormals to zero */
+#ifdef SINGLE_PRECISION
+#define FLOAT float
+#else
 #define FLOAT double
+#endif
+#define VOICES 4 // channels run side by side in the multichannel kernel
+#define STATBUCKETS 15 // block times under 1, 2, 4 ... 8192 us and above
+
+/* what a channel of a multichannel signal keeps between blocks besides its
+   two integrator states */
+typedef struct _zdsvvoice
+{
+    FLOAT v_cutoffold;
+    FLOAT v_resonanceold;
+    int v_asleep;
+    FLOAT v_coefg;
+    FLOAT v_coefd;
+    FLOAT v_coefcutoff;
+    FLOAT v_coefresonance;
+    FLOAT v_coefsr;
+} t_zdsvvoice;
 
 
 typedef struct _zdsv
@@ -33,13 +65,62 @@ typedef struct _zdsv
     FLOAT s1;
     FLOAT s2;
     FLOAT PI;
+    int coeffrate; // 0: once per block, 1: every sample, N: every N samples
+
+    /* block rate coefficients, kept while cutoff, resonance and the
+       sample rate they were made for stay the same, see zdsv_blockcoeffs */
+    FLOAT coefg;
+    FLOAT coefd;
+    FLOAT coefcutoff;
+    FLOAT coefresonance;
+    FLOAT coefsr; // 0 until the first block
+
+    /* tail sleep: skip the filter while the input is silent and the state
+       has decayed below sleepthresh (0 = never sleep) */
+    FLOAT sleepthresh;
+    int asleep;
+    long sleepcount; // times the filter went to sleep
+    long sleepblocks; // blocks skipped
+    long totalblocks;
+
+    /* multichannel: one voice per channel of the left inlet, the cutoff
+       and resonance inlets have either as many channels or one for all.
+       the integrator states are channel interleaved, voicestate[c] is s1
+       and voicestate[nchans + c] s2 of channel c, so that with coeffrate 0
+       VOICES channels run side by side. other settings take the channels
+       one at a time, swapped in and out of s1, s2 and the old values */
+    int nchans;
+    int cutchans;
+    int reschans;
+    FLOAT *voicestate;
+    t_zdsvvoice *voices;
 
+    int batch; // batch 1, see zdsv_perform_batch
+    int pending; // the last block is waiting in zdsv_batchlist
+    t_float *batchbuf; // 6 * batchn: input, cutoff, resonance, 3 outputs
+    int batchn;
+
+    /* profile 1: the time each DSP block of this object takes, see
+       zdsv_stats */
+    int profile;
+    double statstart; // when the running block began
+    double statshare; // batch time to charge to this block, see zdsv_runbatch
+    double statperiod; // seconds of signal in a block
+    double stattotal;
+    double statmax;
+    long statblocks;
+    long stathist[STATBUCKETS];
 } t_zdsv;
 
 
 
 static t_class *zdsv_class;
 
+/* the single channel objects with batching on leave their blocks here */
+static t_zdsv **zdsv_batchlist;
+static int zdsv_batchcount; // blocks waiting
+static int zdsv_batchobjects; // with batching on, zdsv_batchlist has room for all
+
 
 
 static void *zdsv_new( void)
@@ -56,9 +137,244 @@ static void *zdsv_new( void)
     x->PI = 4.0f * atanf(1.0f);
     x->p_cutoff = x->cutoffold = 0.0f;
     x->p_resonance = x->resonanceold = 1.0f;
+    x->coeffrate = 0;
+    x->coefg = x->coefd = x->coefcutoff = x->coefresonance = x->coefsr = 0;
+    x->sleepthresh = 0;
+    x->asleep = 0;
+    x->sleepcount = x->sleepblocks = x->totalblocks = 0;
+    x->nchans = x->cutchans = x->reschans = 1;
+    x->voicestate = 0;
+    x->voices = 0;
+    x->batch = x->pending = 0;
+    x->batchbuf = 0;
+    x->batchn = 0;
+    x->profile = 0;
+    x->statperiod = x->statshare = 0;
     return (x);
 }
 
+/* how often the prewarp coefficients are computed: 0 = once per block,
+   1 = exact at audio rate, N = every N samples with linear interpolation */
+static void zdsv_coeffrate(t_zdsv *x, t_float coeffrate)
+{
+    if (coeffrate < 0)
+        x->coeffrate = 0;
+    else x->coeffrate = coeffrate;
+    x->asleep = 0;
+}
+
+/* sleep <threshold>: state level below which a silent filter stops
+   computing, 0 (default) to never sleep */
+static void zdsv_sleep(t_zdsv *x, t_float thresh)
+{
+    x->sleepthresh = (thresh > 0 ? thresh : 0);
+    x->asleep = 0;
+}
+
+static void zdsv_print(t_zdsv *x)
+{
+    post("channels: %d", x->nchans);
+    post("memory: %d bytes", (int)(sizeof(t_zdsv)
+        + (x->voices ? x->nchans * (2 * sizeof(FLOAT)
+            + sizeof(t_zdsvvoice)) : 0)
+        + (x->batchbuf ? 6 * x->batchn * sizeof(t_float) : 0)));
+    if (x->batch && x->nchans > 1)
+        post("batch: on but not used, the input has %d channels",
+            x->nchans);
+    else if (x->batch)
+        post("batch: on (%d objects), one block of latency",
+            zdsv_batchobjects);
+    else post("batch: off");
+    if (x->sleepthresh > 0)
+        post("sleep: below %g, %s, slept %ld of %ld blocks (%ld times)",
+            x->sleepthresh, (x->asleep ? "asleep" : "awake"),
+            x->sleepblocks, x->totalblocks, x->sleepcount);
+    else post("sleep: off");
+}
+
+/* seconds on a monotonic clock, for profile */
+static double zdsv_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return ((double)count.QuadPart / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+#endif
+}
+
+/* the two ends of a timed block, added around the perform routine */
+static t_int *zdsv_statbegin(t_int *w)
+{
+    t_zdsv *x = (t_zdsv *)(w[1]);
+    x->statstart = zdsv_now();
+    return (w+2);
+}
+
+static t_int *zdsv_statend(t_int *w)
+{
+    t_zdsv *x = (t_zdsv *)(w[1]);
+    double t = zdsv_now() - x->statstart + x->statshare, us;
+    int b = 0;
+    if (t < 0)
+        t = 0;
+    x->statshare = 0;
+    us = t * 1e6;
+    x->statblocks++;
+    x->stattotal += t;
+    if (t > x->statmax)
+        x->statmax = t;
+    for (; us >= 1 && b < STATBUCKETS - 1; us *= 0.5)
+        b++;
+    x->stathist[b]++;
+    return (w+2);
+}
+
+/* profile <0|1>: time every block of this object for stats. the timing
+   routines only go into the DSP chain while this is on, so off it costs
+   nothing. turning it on starts the counts afresh. with batch 1 each
+   object is charged for its share of the batch */
+static void zdsv_profile(t_zdsv *x, t_float f)
+{
+    int i;
+    if (f != 0)
+    {
+        x->statblocks = 0;
+        x->stattotal = x->statmax = x->statshare = 0;
+        for (i = 0; i < STATBUCKETS; i++)
+            x->stathist[i] = 0;
+    }
+    if ((f != 0) == x->profile)
+        return;
+    x->profile = (f != 0);
+    canvas_update_dsp();
+}
+
+/* stats: post the block times counted since profile 1, as the mean and
+   the longest block, the share of real time they take and a histogram */
+static void zdsv_stats(t_zdsv *x)
+{
+    int i;
+    if (!x->statblocks)
+    {
+        post("zdsv~: no blocks timed%s", (x->profile ? "" :
+            ", profile is off"));
+        return;
+    }
+    post("zdsv~: %ld blocks, mean %.2f us, max %.2f us, %.2f%% of real time",
+        x->statblocks, 1e6 * x->stattotal / x->statblocks, 1e6 * x->statmax,
+        (x->statperiod > 0 ? 100 * x->stattotal
+            / (x->statblocks * x->statperiod) : 0));
+    for (i = 0; i < STATBUCKETS - 1; i++)
+        if (x->stathist[i])
+            post("  under %d us: %ld", 1 << i, x->stathist[i]);
+    if (x->stathist[i])
+        post("  %d us and over: %ld", 1 << (i - 1), x->stathist[i]);
+}
+
+/* nonzero if the input block is all zeros */
+static int zdsv_silent(t_float *in, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (in[i] != 0)
+            return (0);
+    return (1);
+}
+
+/* a signal that holds one value for the whole block, as a float sent to
+   a signal inlet does */
+static int zdsv_constant(t_float *in, int n)
+{
+    int i;
+    for (i = 1; i < n; i++)
+        if (in[i] != in[0])
+            return (0);
+    return (1);
+}
+
+static FLOAT zdsv_clipcutoff(t_zdsv *x, FLOAT cutoff)
+{
+    if (cutoff > x->x_sr*0.48f)
+        return (x->x_sr*0.48f);
+    if (cutoff < 0.0003f)
+        return (0.0003f);
+    return (cutoff);
+}
+
+/* resonance 0..100 to the damping R, 1..0.0005 */
+static FLOAT zdsv_damping(FLOAT resonance)
+{
+    FLOAT r = (1 - 0.01f*resonance);
+    if (r > 1)
+        return (1);
+    if (r < 0.0005f)
+        return (0.0005f);
+    return (r);
+}
+
+/* bilinear prewarp: integrator gain g and d = 1/(1 + 2Rg + g^2) */
+static void zdsv_coeffs(t_zdsv *x, FLOAT cutoff, FLOAT resonance, FLOAT *g, FLOAT *d)
+{
+    FLOAT wd = 2*x->PI*cutoff;
+    FLOAT wa = (2.0f * x->x_sr) * tan(wd * x->T * 0.5f);
+    *g = wa * x->T * 0.5f;
+    *d = 1. / (1. + 2. * resonance * *g + *g * *g);
+}
+
+/* coefficients at p_cutoff and p_resonance for a whole block, from the
+   last block when nothing they depend on has changed */
+static void zdsv_blockcoeffs(t_zdsv *x, FLOAT *g, FLOAT *d)
+{
+    if (x->p_cutoff != x->coefcutoff || x->p_resonance != x->coefresonance
+        || x->x_sr != x->coefsr)
+    {
+        zdsv_coeffs(x, x->p_cutoff, x->p_resonance, &x->coefg, &x->coefd);
+        x->coefcutoff = x->p_cutoff;
+        x->coefresonance = x->p_resonance;
+        x->coefsr = x->x_sr;
+    }
+    *g = x->coefg;
+    *d = x->coefd;
+}
+
+/* sleep check and the clipped cutoff and resonance of the block, nonzero
+   if the filter is asleep and the outputs have been zeroed */
+static int zdsv_begin(t_zdsv *x, t_float *in1, t_float *cutoffin,
+    t_float *resonancein, t_float *out1, t_float *out2, t_float *out3, int n)
+{
+    int i;
+
+    x->totalblocks++;
+    if (x->sleepthresh > 0 && zdsv_silent(in1, n) && (x->asleep
+        || (fabs(x->s1) < x->sleepthresh && fabs(x->s2) < x->sleepthresh)))
+    {
+        if (!x->asleep) // flush the decayed tail once
+        {
+            x->s1 = x->s2 = x->x_lp = x->x_bp = x->x_hp = 0;
+            x->asleep = 1;
+            x->sleepcount++;
+        }
+        x->sleepblocks++;
+        for (i = 0; i < n; i++)
+            out1[i] = out2[i] = out3[i] = 0;
+        return (1);
+    }
+    x->asleep = 0;
+    FLOAT oneoverblocksize = 1.0f/n;
+     
+    x->p_cutoff = x->cutoffold = zdsv_clipcutoff(x, *cutoffin);
+    x->p_resonance = x->resonanceold = zdsv_damping(*resonancein);
+
+    x->cutoffincrement = (x->p_cutoff - x->cutoffold) * oneoverblocksize;
+    x->resonanceincrement = (x->p_resonance - x->resonanceold) * oneoverblocksize;
+    return (0);
+}
+
 static t_int *zdsv_perform(t_int *w)
 {
     t_zdsv *x = (t_zdsv *)(w[1]);
@@ -70,40 +386,41 @@ static t_int *zdsv_perform(t_int *w)
     t_float *out3 = (t_float *)(w[7]);
     int n = (int)(w[8]), i, j;
     x->T = 1.0f / x->x_sr; // sampling period
-    FLOAT oneoverblocksize = 1.0f/n;
-     
-    x->p_cutoff = *cutoffin++;
-    if(x->p_cutoff != x->cutoffold) // clip cutoff values
-    {
-       if(x->p_cutoff > x->x_sr*0.48f)
-            x->cutoffold = x->p_cutoff = x->x_sr*0.48f;
-        else if(x->p_cutoff < 0.0003f)
-            x->cutoffold = x->p_cutoff = 0.0003f;
-        else
-            x->cutoffold = x->p_cutoff;
-    }
-    x->p_resonance = (1 - 0.01f**resonancein++);
-    if(x->p_resonance != x->resonanceold) // clip resonance values
-    {
-       if(x->p_resonance > 1)
-            x->resonanceold = x->p_resonance = 1;
-        else if(x->p_resonance < 0.0005f)
-            x->resonanceold = x->p_resonance = 0.0005f;
-        else
-            x->resonanceold = x->p_resonance;
-    }
-
-    x->cutoffincrement = (x->p_cutoff - x->cutoffold) * oneoverblocksize;
-    x->resonanceincrement = (x->p_resonance - x->resonanceold) * oneoverblocksize;
 
+    if (zdsv_begin(x, in1, cutoffin, resonancein, out1, out2, out3, n))
+        return (w+9);
+    FLOAT g, d, ginc = 0, dinc = 0;
+    /* the coefficients follow the inlets within the block only at
+       coeffrate 1 or N and only while an inlet moves; constant inlets and
+       floats take the block rate coefficients */
+    int moves = (x->coeffrate > 0 && !(zdsv_constant(cutoffin, n)
+        && zdsv_constant(resonancein, n)));
+    if (!moves)
+        zdsv_blockcoeffs(x, &g, &d);
     for (i = 0; i < n; i++)
     {
         x->p_input = *in1++;
-        FLOAT wd = 2*x->PI*x->p_cutoff;
-        FLOAT wa = (2.0f * x->x_sr) * tan(wd * x->T * 0.5f);
-        FLOAT g = wa * x->T * 0.5f;
+        /* exact at the start of the block (and every sample at audio rate),
+           otherwise interpolated towards the end of each coeffrate segment */
+        if (moves)
+        {
+            x->p_cutoff = zdsv_clipcutoff(x, cutoffin[i]);
+            x->p_resonance = zdsv_damping(resonancein[i]);
+            if (i == 0 || x->coeffrate == 1)
+                zdsv_coeffs(x, x->p_cutoff, x->p_resonance, &g, &d);
+            if (x->coeffrate > 1 && i % x->coeffrate == 0)
+            {
+                int len = (n - i < x->coeffrate ? n - i : x->coeffrate);
+                int end = (i + len < n ? i + len : n - 1);
+                FLOAT gend, dend;
+                zdsv_coeffs(x, zdsv_clipcutoff(x, cutoffin[end]),
+                    zdsv_damping(resonancein[end]), &gend, &dend);
+                ginc = (gend - g) / len;
+                dinc = (dend - d) / len;
+            }
+        }
 
-        x->x_hp = (x->p_input - 2. * x->p_resonance * x->s1 - g * x->s1 - x->s2) / (1. + 2. * x->p_resonance * g + g * g); 
+        x->x_hp = (x->p_input - 2.0f * x->p_resonance * x->s1 - g * x->s1 - x->s2) * d; 
         x->x_bp = g * x->x_hp + x->s1; 
         x->s1 = g * x->x_hp + x->x_bp; // state update in 1st integrator 
         x->x_lp = g * x->x_bp + x->s2; 
@@ -111,24 +428,402 @@ static t_int *zdsv_perform(t_int *w)
         *out1++ = x->x_lp;
         *out2++ = x->x_bp;
         *out3++ = x->x_hp;
-        x->p_cutoff += x->cutoffincrement;
-        x->p_resonance += x->resonanceincrement;
+        g += ginc;
+        d += dinc;
+    }
+    return (w+9);
+}
+
+/* swap voice c in and out of s1, s2 and the single voice fields */
+static void zdsv_load(t_zdsv *x, int c)
+{
+    x->s1 = x->voicestate[c];
+    x->s2 = x->voicestate[x->nchans + c];
+    x->cutoffold = x->voices[c].v_cutoffold;
+    x->resonanceold = x->voices[c].v_resonanceold;
+    x->asleep = x->voices[c].v_asleep;
+    x->coefg = x->voices[c].v_coefg;
+    x->coefd = x->voices[c].v_coefd;
+    x->coefcutoff = x->voices[c].v_coefcutoff;
+    x->coefresonance = x->voices[c].v_coefresonance;
+    x->coefsr = x->voices[c].v_coefsr;
+}
+
+static void zdsv_store(t_zdsv *x, int c)
+{
+    x->voicestate[c] = x->s1;
+    x->voicestate[x->nchans + c] = x->s2;
+    x->voices[c].v_cutoffold = x->cutoffold;
+    x->voices[c].v_resonanceold = x->resonanceold;
+    x->voices[c].v_asleep = x->asleep;
+    x->voices[c].v_coefg = x->coefg;
+    x->voices[c].v_coefd = x->coefd;
+    x->voices[c].v_coefcutoff = x->coefcutoff;
+    x->voices[c].v_coefresonance = x->coefresonance;
+    x->voices[c].v_coefsr = x->coefsr;
+}
+
+/* VOICES voices with coefficients fixed over the block (coeffrate 0), one
+   per lane, each doing what zdsv_perform does for it. the states of lane
+   l are *s1v[l] and *s2v[l] */
+static void zdsv_lanes(FLOAT **s1v, FLOAT **s2v, t_float **inv,
+    t_float **out1v, t_float **out2v, t_float **out3v, int n,
+    const FLOAT *g, const FLOAT *d, FLOAT *resonance,
+    const FLOAT *resonanceinc)
+{
+    FLOAT state1[VOICES], state2[VOICES], in, hp, bp, lp;
+    int i, l;
+
+    for (l = 0; l < VOICES; l++)
+        state1[l] = *s1v[l], state2[l] = *s2v[l];
+    for (i = 0; i < n; i++)
+    {
+        for (l = 0; l < VOICES; l++)
+        {
+            in = inv[l][i];
+            hp = (in - 2.0f * resonance[l] * state1[l] - g[l] * state1[l]
+                - state2[l]) * d[l];
+            bp = g[l] * hp + state1[l];
+            state1[l] = g[l] * hp + bp;
+            lp = g[l] * bp + state2[l];
+            state2[l] = g[l] * bp + lp;
+            out1v[l][i] = lp;
+            out2v[l][i] = bp;
+            out3v[l][i] = hp;
+            resonance[l] += resonanceinc[l];
+        }
+    }
+    for (l = 0; l < VOICES; l++)
+        *s1v[l] = state1[l], *s2v[l] = state2[l];
+}
+
+/* multichannel block: with coeffrate 0 whole groups of VOICES channels
+   run in lanes, every other channel goes through zdsv_perform */
+static t_int *zdsv_perform_voices(t_int *w)
+{
+    t_zdsv *x = (t_zdsv *)(w[1]);
+    t_float *in1 = (t_float *)(w[2]);
+    t_float *cutoffin = (t_float *)(w[3]);
+    t_float *resonancein = (t_float *)(w[4]);
+    t_float *out1 = (t_float *)(w[5]);
+    t_float *out2 = (t_float *)(w[6]);
+    t_float *out3 = (t_float *)(w[7]);
+    int n = (int)(w[8]), nchans = x->nchans, c, l, o, awake;
+    int lanes = (x->coeffrate == 0 ? nchans - nchans % VOICES : 0);
+    FLOAT g[VOICES], d[VOICES], resonance[VOICES], resonanceinc[VOICES];
+    FLOAT *s1v[VOICES], *s2v[VOICES];
+    t_float *inv[VOICES], *out1v[VOICES], *out2v[VOICES], *out3v[VOICES];
+    t_int vw[9];
+
+    vw[1] = (t_int)x;
+    vw[8] = n;
+    for (c = lanes; c < nchans; c++)
+    {
+        zdsv_load(x, c);
+        vw[2] = (t_int)(in1 + c * n);
+        vw[3] = (t_int)(cutoffin + (c % x->cutchans) * n);
+        vw[4] = (t_int)(resonancein + (c % x->reschans) * n);
+        vw[5] = (t_int)(out1 + c * n);
+        vw[6] = (t_int)(out2 + c * n);
+        vw[7] = (t_int)(out3 + c * n);
+        zdsv_perform(vw);
+        zdsv_store(x, c);
+    }
+    x->T = 1.0f / x->x_sr;
+    for (c = 0; c < lanes; c += VOICES)
+    {
+        for (l = awake = 0; l < VOICES; l++)
+        {
+            o = (c + l) * n;
+            s1v[l] = x->voicestate + c + l;
+            s2v[l] = x->voicestate + nchans + c + l;
+            inv[l] = in1 + o;
+            out1v[l] = out1 + o;
+            out2v[l] = out2 + o;
+            out3v[l] = out3 + o;
+            zdsv_load(x, c + l);
+            if (zdsv_begin(x, inv[l],
+                cutoffin + ((c + l) % x->cutchans) * n,
+                resonancein + ((c + l) % x->reschans) * n,
+                out1v[l], out2v[l], out3v[l], n))
+            {
+                /* zero state and silent input: the lane stays at zero */
+                g[l] = d[l] = resonance[l] = resonanceinc[l] = 0;
+            }
+            else
+            {
+                zdsv_blockcoeffs(x, &g[l], &d[l]);
+                resonance[l] = x->p_resonance;
+                resonanceinc[l] = x->resonanceincrement;
+                awake++;
+            }
+            zdsv_store(x, c + l);
+        }
+        if (awake)
+            zdsv_lanes(s1v, s2v, inv, out1v, out2v, out3v, n, g, d,
+                resonance, resonanceinc);
     }
     return (w+9);
 }
 
+/* one voice per channel, all of them starting from silence. called from
+   the dsp method only */
+static void zdsv_setchans(t_zdsv *x, int nchans)
+{
+    int c;
+    if (x->voicestate)
+    {
+        freebytes(x->voicestate, 2 * x->nchans * sizeof(FLOAT));
+        freebytes(x->voices, x->nchans * sizeof(t_zdsvvoice));
+        x->voicestate = 0;
+        x->voices = 0;
+    }
+    x->nchans = 1;
+    if (nchans > 1)
+    {
+        x->voicestate = (FLOAT *)getbytes(2 * nchans * sizeof(FLOAT));
+        x->voices = (t_zdsvvoice *)getbytes(nchans * sizeof(t_zdsvvoice));
+        if (!x->voicestate || !x->voices)
+        {
+            pd_error(x, "zdsv~: out of memory for %d channels", nchans);
+            if (x->voicestate)
+                freebytes(x->voicestate, 2 * nchans * sizeof(FLOAT));
+            if (x->voices)
+                freebytes(x->voices, nchans * sizeof(t_zdsvvoice));
+            x->voicestate = 0;
+            x->voices = 0;
+            return;
+        }
+        x->nchans = nchans;
+        for (c = 0; c < nchans; c++)
+        {
+            x->voices[c].v_cutoffold = 0;
+            x->voices[c].v_resonanceold = 1;
+            x->voices[c].v_asleep = 0;
+            x->voices[c].v_coefsr = 0;
+        }
+    }
+}
+
+/* run the blocks waiting in the batch: objects at coeffrate 0 go
+   through the lane kernel VOICES at a time, the rest one by one. with
+   profile 1 each object is charged for the time of its group split evenly
+   between the objects in it, to be added to its next timed block */
+static void zdsv_runbatch(void)
+{
+    t_zdsv *group[VOICES], *x, *y;
+    FLOAT g[VOICES], d[VOICES], resonance[VOICES], resonanceinc[VOICES];
+    FLOAT *s1v[VOICES], *s2v[VOICES];
+    t_float *inv[VOICES], *out1v[VOICES], *out2v[VOICES], *out3v[VOICES];
+    int b, i, l, n, prof;
+    double t;
+    t_int vw[9];
+
+    for (b = 0; b < zdsv_batchcount; b++)
+    {
+        if (!(x = zdsv_batchlist[b])->pending)
+            continue; // ran in an earlier group
+        n = x->batchn;
+        group[0] = x;
+        for (i = b + 1, l = 1; i < zdsv_batchcount && l < VOICES; i++)
+        {
+            y = zdsv_batchlist[i];
+            if (y->pending && !y->coeffrate && y->x_sr == x->x_sr
+                && y->batchn == n)
+                    group[l++] = y;
+        }
+        if (l < VOICES || x->coeffrate)
+        {
+            vw[1] = (t_int)x;
+            for (i = 0; i < 6; i++)
+                vw[2 + i] = (t_int)(x->batchbuf + i * n);
+            vw[8] = n;
+            t = ((prof = x->profile) ? zdsv_now() : 0);
+            zdsv_perform(vw);
+            if (prof)
+                x->statshare += zdsv_now() - t;
+            x->pending = 0;
+            continue;
+        }
+        for (l = prof = 0; l < VOICES; l++)
+            prof |= group[l]->profile;
+        t = (prof ? zdsv_now() : 0);
+        for (l = 0; l < VOICES; l++)
+        {
+            y = group[l];
+            y->T = 1.0f / y->x_sr;
+            s1v[l] = &y->s1;
+            s2v[l] = &y->s2;
+            inv[l] = y->batchbuf;
+            out1v[l] = y->batchbuf + 3 * n;
+            out2v[l] = y->batchbuf + 4 * n;
+            out3v[l] = y->batchbuf + 5 * n;
+            if (zdsv_begin(y, inv[l], y->batchbuf + n, y->batchbuf + 2 * n,
+                out1v[l], out2v[l], out3v[l], n))
+                    g[l] = d[l] = resonance[l] = resonanceinc[l] = 0;
+            else
+            {
+                zdsv_blockcoeffs(y, &g[l], &d[l]);
+                resonance[l] = y->p_resonance;
+                resonanceinc[l] = y->resonanceincrement;
+            }
+            y->pending = 0;
+        }
+        zdsv_lanes(s1v, s2v, inv, out1v, out2v, out3v, n, g, d,
+            resonance, resonanceinc);
+        if (prof)
+        {
+            t = (zdsv_now() - t) / VOICES;
+            for (l = 0; l < VOICES; l++)
+                if (group[l]->profile)
+                    group[l]->statshare += t;
+        }
+    }
+    zdsv_batchcount = 0;
+}
+
+/* batched block: Pd calls every object on its own, so the blocks are
+   collected and run together by the first object that comes back with
+   its last block still waiting. each object gets the output of the block
+   before, whatever its place in the DSP chain */
+static t_int *zdsv_perform_batch(t_int *w)
+{
+    t_zdsv *x = (t_zdsv *)(w[1]);
+    int n = (int)(w[8]), i;
+    double t;
+
+    if (x->pending)
+    {
+        /* the batch is charged to the objects in it, not to this one */
+        t = (x->profile ? zdsv_now() : 0);
+        zdsv_runbatch();
+        if (x->profile)
+            x->statshare -= zdsv_now() - t;
+    }
+    for (i = 0; i < 3; i++)
+        memcpy(x->batchbuf + i * n, (t_float *)(w[2 + i]),
+            n * sizeof(t_float));
+    for (i = 3; i < 6; i++)
+        memcpy((t_float *)(w[2 + i]), x->batchbuf + i * n,
+            n * sizeof(t_float));
+    x->pending = 1;
+    zdsv_batchlist[zdsv_batchcount++] = x;
+    return (w+9);
+}
+
+/* take x's block out of the batch and (re)allocate its buffer for block
+   size n, or free it with batching off */
+static void zdsv_setbatch(t_zdsv *x, int n)
+{
+    int b;
+    for (b = 0; b < zdsv_batchcount; b++)
+        if (zdsv_batchlist[b] == x)
+        {
+            memmove(zdsv_batchlist + b, zdsv_batchlist + b + 1,
+                (--zdsv_batchcount - b) * sizeof(t_zdsv *));
+            break;
+        }
+    x->pending = 0;
+    if (x->batchbuf)
+        freebytes(x->batchbuf, 6 * x->batchn * sizeof(t_float));
+    x->batchbuf = 0;
+    x->batchn = n;
+    if (x->batch && n && !(x->batchbuf =
+        (t_float *)getbytes(6 * n * sizeof(t_float))))
+            pd_error(x, "zdsv~: out of memory for batching");
+}
+
+static void zdsv_setbatching(t_zdsv *x, int on)
+{
+    t_zdsv **list;
+    if (on == x->batch)
+        return;
+    if (on)
+    {
+        if (!(list = (t_zdsv **)resizebytes(zdsv_batchlist,
+            zdsv_batchobjects * sizeof(t_zdsv *),
+            (zdsv_batchobjects + 1) * sizeof(t_zdsv *))))
+        {
+            pd_error(x, "zdsv~: out of memory for batching");
+            return;
+        }
+        zdsv_batchlist = list;
+        zdsv_batchobjects++;
+    }
+    else zdsv_batchobjects--;
+    x->batch = on;
+    zdsv_setbatch(x, x->batchn);
+}
+
+/* batch 1: run together with the other zdsv~ objects that have it on, in
+   lanes for those at coeffrate 0. saves the per object overhead and fills
+   the lanes for single channel objects, at the price of one block of
+   latency. objects with a multichannel input run on their own. the
+   perform routine changes, so the DSP chain is rebuilt */
+static void zdsv_batch(t_zdsv *x, t_float f)
+{
+    if ((f != 0) == x->batch)
+        return;
+    zdsv_setbatching(x, (f != 0));
+    canvas_update_dsp();
+}
+
+static void zdsv_free(t_zdsv *x)
+{
+    zdsv_setchans(x, 1);
+    zdsv_setbatching(x, 0);
+}
+
 static void zdsv_dsp(t_zdsv *x, t_signal **sp)
 {
+    int nchans = 1;
     x->x_sr = sp[0]->s_sr;
-    dsp_add(zdsv_perform, 8, x, sp[0]->s_vec, sp[1]->s_vec,
-        sp[2]->s_vec, sp[3]->s_vec, sp[4]->s_vec, sp[5]->s_vec, sp[0]->s_n);
+#ifdef CLASS_MULTICHANNEL
+    nchans = sp[0]->s_nchans;
+    x->cutchans = sp[1]->s_nchans;
+    x->reschans = sp[2]->s_nchans;
+    signal_setmultiout(&sp[3], nchans);
+    signal_setmultiout(&sp[4], nchans);
+    signal_setmultiout(&sp[5], nchans);
+#endif
+    if (nchans != x->nchans)
+        zdsv_setchans(x, nchans);
+    if (nchans > 1 && x->nchans == 1) // no memory for the voices
+    {
+        dsp_add_zero(sp[3]->s_vec, nchans * sp[0]->s_n);
+        dsp_add_zero(sp[4]->s_vec, nchans * sp[0]->s_n);
+        dsp_add_zero(sp[5]->s_vec, nchans * sp[0]->s_n);
+        return;
+    }
+    if (x->batch)
+        zdsv_setbatch(x, sp[0]->s_n);
+    x->statperiod = sp[0]->s_n / sp[0]->s_sr;
+    if (x->profile)
+        dsp_add(zdsv_statbegin, 1, x);
+    dsp_add((x->nchans > 1 ? zdsv_perform_voices : x->batchbuf ?
+        zdsv_perform_batch : zdsv_perform), 8, x,
+        sp[0]->s_vec, sp[1]->s_vec, sp[2]->s_vec, sp[3]->s_vec,
+        sp[4]->s_vec, sp[5]->s_vec, sp[0]->s_n);
+    if (x->profile)
+        dsp_add(zdsv_statend, 1, x);
 }
 
 void zdsv_tilde_setup(void)
 {
     int i;
+#ifdef CLASS_MULTICHANNEL
+    zdsv_class = class_new(gensym("zdsv~"), (t_newmethod)zdsv_new,
+        (t_method)zdsv_free, sizeof(t_zdsv), CLASS_MULTICHANNEL, 0);
+#else
     zdsv_class = class_new(gensym("zdsv~"),
-        (t_newmethod)zdsv_new, 0, sizeof(t_zdsv), 0, 0);
+        (t_newmethod)zdsv_new, (t_method)zdsv_free, sizeof(t_zdsv), 0, 0);
+#endif
     class_addmethod(zdsv_class, (t_method)zdsv_dsp, gensym("dsp"), A_CANT, 0);
+    class_addmethod(zdsv_class, (t_method)zdsv_coeffrate, gensym("coeffrate"), A_FLOAT, 0);
+    class_addmethod(zdsv_class, (t_method)zdsv_sleep, gensym("sleep"), A_FLOAT, 0);
+    class_addmethod(zdsv_class, (t_method)zdsv_print, gensym("print"), 0);
+    class_addmethod(zdsv_class, (t_method)zdsv_batch, gensym("batch"), A_FLOAT, 0);
+    class_addmethod(zdsv_class, (t_method)zdsv_profile, gensym("profile"), A_FLOAT, 0);
+    class_addmethod(zdsv_class, (t_method)zdsv_stats, gensym("stats"), 0);
     CLASS_MAINSIGNALIN(zdsv_class, t_zdsv, x_f);
 }